@@ -1,6 +1,11 @@
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 #include <list.h>
 #include <stdio.h>
 #include <string.h>
@@ -16,10 +21,40 @@ struct block {
   const struct block_operations *ops; /* Driver operations. */
   void *aux;                          /* Extra data owned by driver. */
 
-  unsigned long long read_cnt;  /* Number of sectors read. */
-  unsigned long long write_cnt; /* Number of sectors written. */
+  struct iostat stats; /* Statistics, without name and role. */
+
+  /* Asynchronous requests, carried out by the device's I/O
+     thread, which is started by the first block_submit(), in the
+     order chosen by the I/O scheduler. */
+  struct lock queue_lock;       /* Protects the members below. */
+  struct list queue;            /* Pending requests, in iosched order. */
+  struct list fifo;             /* Pending requests, in arrival order. */
+  size_t queue_len;             /* Number of pending requests. */
+  block_sector_t head;          /* Sector after the last one dispatched. */
+  struct condition queue_ready; /* Signaled when QUEUE is nonempty. */
+  bool io_thread_started;       /* Has the I/O thread been created? */
+  size_t max_queue_len;         /* Longest the queue has been. */
+};
+
+/* An I/O scheduler, which orders each device's queue of pending
+   requests.  Runs with the device's queue_lock held. */
+struct iosched {
+  const char *name;
+  /* Adds REQ to BLOCK's queue. */
+  void (*add)(struct block *, struct block_request *req);
+  /* Returns the request in BLOCK's nonempty queue to carry out
+     next, without removing it. */
+  struct block_request *(*next)(struct block *);
 };
 
+/* Maximum number of sectors in a transfer formed by merging
+   requests for adjacent sectors. */
+#define BLOCK_MERGE_MAX 64
+
+/* Ticks a request may wait under the deadline scheduler. */
+#define READ_EXPIRE (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (5 * TIMER_FREQ)
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER(all_blocks);
 
@@ -27,6 +62,7 @@ static struct list all_blocks = LIST_INITIALIZER(all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block(struct list_elem *);
+static thread_func io_thread NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -91,14 +127,64 @@ static void check_sector(struct block *block, block_sector_t sector) {
   }
 }
 
+/* Returns the processor's time-stamp counter. */
+static inline uint64_t rdtsc(void) {
+  /* See [IA32-v2b] "RDTSC". */
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+/* Adds a transfer of CNT sectors that began at time-stamp
+   counter START to BLOCK's statistics. */
+static void account(struct block *block, bool write, size_t cnt,
+                    uint64_t start) {
+  struct iostat *stats = &block->stats;
+  uint64_t cycles = rdtsc() - start;
+  enum intr_level old_level;
+  int bucket;
+
+  for (bucket = 0; bucket < IOSTAT_LATENCY_CNT - 1; bucket++)
+    if (cycles >> (bucket + 1) == 0)
+      break;
+
+  /* Transfers may finish in several threads at once. */
+  old_level = intr_disable();
+  if (write) {
+    stats->write_cnt += cnt;
+    stats->write_bytes += cnt * BLOCK_SECTOR_SIZE;
+  } else {
+    stats->read_cnt += cnt;
+    stats->read_bytes += cnt * BLOCK_SECTOR_SIZE;
+  }
+  stats->transfer_cnt++;
+  stats->busy_cycles += cycles;
+  stats->latency[bucket]++;
+  intr_set_level(old_level);
+}
+
+/* Verifies that the CNT sectors starting at SECTOR lie within
+   BLOCK.  Panics if not. */
+static void check_sectors(struct block *block, block_sector_t sector,
+                          size_t cnt) {
+  check_sector(block, sector);
+  if (cnt > block->size - sector)
+    PANIC("Access past end of device %s (sector=%" PRDSNu ", cnt=%zu, "
+          "size=%" PRDSNu ")\n",
+          block_name(block), sector, cnt, block->size);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
    per-block device locking is unneeded. */
 void block_read(struct block *block, block_sector_t sector, void *buffer) {
+  uint64_t start;
+
   check_sector(block, sector);
+  start = rdtsc();
   block->ops->read(block->aux, sector, buffer);
-  block->read_cnt++;
+  account(block, false, 1, start);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -108,10 +194,278 @@ void block_read(struct block *block, block_sector_t sector, void *buffer) {
    per-block device locking is unneeded. */
 void block_write(struct block *block, block_sector_t sector,
                  const void *buffer) {
+  uint64_t start;
+
   check_sector(block, sector);
   ASSERT(block->type != BLOCK_FOREIGN);
+  start = rdtsc();
   block->ops->write(block->aux, sector, buffer);
-  block->write_cnt++;
+  account(block, true, 1, start);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it transfer all of the sectors
+   with a single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void block_read_multiple(struct block *block, block_sector_t sector,
+                         size_t cnt, void *buffer_) {
+  uint8_t *buffer = buffer_;
+  uint64_t start;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sectors(block, sector, cnt);
+  start = rdtsc();
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple(block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read(block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+  account(block, false, cnt, start);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  Drivers that support it transfer all of the sectors
+   with a single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void block_write_multiple(struct block *block, block_sector_t sector,
+                          size_t cnt, const void *buffer_) {
+  const uint8_t *buffer = buffer_;
+  uint64_t start;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sectors(block, sector, cnt);
+  ASSERT(block->type != BLOCK_FOREIGN);
+  start = rdtsc();
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple(block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write(block->aux, sector + i,
+                        buffer + i * BLOCK_SECTOR_SIZE);
+  account(block, true, cnt, start);
+}
+
+/* Initializes REQ as a request to transfer CNT sectors starting
+   at SECTOR between a block device and BUFFER, writing to the
+   device if WRITE is true and reading from it otherwise.  When
+   the request completes, CALLBACK is called with REQ and AUX if
+   it is non-null; otherwise, block_wait() returns. */
+void block_request_init(struct block_request *req, bool write,
+                        block_sector_t sector, size_t cnt, void *buffer,
+                        block_callback_func *callback, void *aux) {
+  req->write = write;
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffer = buffer;
+  req->callback = callback;
+  req->aux = aux;
+  sema_init(&req->done, 0);
+}
+
+/* No-op scheduler: requests are carried out in arrival order. */
+static void noop_add(struct block *block, struct block_request *req) {
+  list_push_back(&block->queue, &req->elem);
+}
+
+static struct block_request *noop_next(struct block *block) {
+  return list_entry(list_front(&block->queue), struct block_request, elem);
+}
+
+/* Returns true if request A starts at a lower sector than B. */
+static bool request_less(const struct list_elem *a,
+                         const struct list_elem *b, void *aux UNUSED) {
+  return list_entry(a, struct block_request, elem)->sector <
+         list_entry(b, struct block_request, elem)->sector;
+}
+
+/* Keeps BLOCK's queue sorted by sector, for the elevator
+   schedulers. */
+static void sorted_add(struct block *block, struct block_request *req) {
+  list_insert_ordered(&block->queue, &req->elem, request_less, NULL);
+}
+
+/* C-LOOK scheduler: sweeps the disk in ascending sector order,
+   taking the first request at or past the head, and then jumps
+   back to the lowest pending sector. */
+static struct block_request *clook_next(struct block *block) {
+  struct list_elem *e;
+
+  for (e = list_begin(&block->queue); e != list_end(&block->queue);
+       e = list_next(e)) {
+    struct block_request *req = list_entry(e, struct block_request, elem);
+    if (req->sector >= block->head)
+      return req;
+  }
+  return noop_next(block);
+}
+
+/* Deadline scheduler: like C-LOOK, except that the oldest
+   request goes first once it has waited past its deadline, so
+   that requests far from the head are not starved.  Reads
+   expire sooner than writes, because readers usually wait. */
+static struct block_request *deadline_next(struct block *block) {
+  struct block_request *oldest =
+      list_entry(list_front(&block->fifo), struct block_request, fifo_elem);
+
+  if (timer_ticks() >= oldest->deadline)
+    return oldest;
+  return clook_next(block);
+}
+
+static const struct iosched ioscheds[] = {
+    {"noop", noop_add, noop_next},
+    {"clook", sorted_add, clook_next},
+    {"deadline", sorted_add, deadline_next},
+};
+
+static const struct iosched *iosched = &ioscheds[1];
+
+/* Selects the I/O scheduler called NAME, one of "noop", "clook"
+   (the default) or "deadline", for every block device.  Returns
+   true if successful, false if there is no such scheduler. */
+bool block_set_scheduler(const char *name) {
+  size_t i;
+
+  for (i = 0; i < sizeof ioscheds / sizeof *ioscheds; i++)
+    if (!strcmp(name, ioscheds[i].name)) {
+      iosched = &ioscheds[i];
+      return true;
+    }
+  return false;
+}
+
+/* Queues REQ on BLOCK and returns without waiting for it.  REQ
+   and its buffer must stay valid until it completes.  The
+   completion callback, if any, runs in BLOCK's I/O thread and
+   must not block for long, since it holds up later requests. */
+void block_submit(struct block *block, struct block_request *req) {
+  check_sectors(block, req->sector, req->cnt);
+  ASSERT(!req->write || block->type != BLOCK_FOREIGN);
+
+  lock_acquire(&block->queue_lock);
+  if (!block->io_thread_started) {
+    char name[sizeof block->name + 3];
+
+    snprintf(name, sizeof name, "io-%s", block->name);
+    if (thread_create(name, PRI_DEFAULT, io_thread, block) == TID_ERROR)
+      PANIC("%s: failed to create I/O thread", block->name);
+    block->io_thread_started = true;
+  }
+  req->deadline = timer_ticks() + (req->write ? WRITE_EXPIRE : READ_EXPIRE);
+  iosched->add(block, req);
+  list_push_back(&block->fifo, &req->fifo_elem);
+  block->stats.request_cnt++;
+  block->stats.depth[block->queue_len < IOSTAT_DEPTH_CNT
+                         ? block->queue_len
+                         : IOSTAT_DEPTH_CNT - 1]++;
+  if (++block->queue_len > block->max_queue_len)
+    block->max_queue_len = block->queue_len;
+  cond_signal(&block->queue_ready, &block->queue_lock);
+  lock_release(&block->queue_lock);
+}
+
+/* Waits for REQ, which must have been submitted without a
+   callback, to complete. */
+void block_wait(struct block_request *req) {
+  ASSERT(req->callback == NULL);
+  sema_down(&req->done);
+}
+
+/* Removes the request that BLOCK's I/O scheduler picks from
+   BLOCK's nonempty queue, along with any requests in the same
+   direction for the sectors that immediately follow, as long as
+   BOUNCE is non-null and the total is at most BLOCK_MERGE_MAX
+   sectors.  Stores the requests into BATCH in sector order and
+   returns how many there are.  Must be called with BLOCK's
+   queue_lock held. */
+static size_t take_batch(struct block *block, bool bounce,
+                         struct block_request *batch[BLOCK_MERGE_MAX]) {
+  struct block_request *req = iosched->next(block);
+  size_t batch_cnt = 0;
+  size_t sector_cnt = 0;
+
+  for (;;) {
+    struct list_elem *next = list_next(&req->elem);
+
+    list_remove(&req->elem);
+    list_remove(&req->fifo_elem);
+    block->queue_len--;
+    batch[batch_cnt++] = req;
+    sector_cnt += req->cnt;
+
+    if (!bounce || next == list_end(&block->queue))
+      break;
+    req = list_entry(next, struct block_request, elem);
+    if (req->write != batch[0]->write ||
+        req->sector != batch[0]->sector + sector_cnt ||
+        sector_cnt + req->cnt > BLOCK_MERGE_MAX)
+      break;
+    block->stats.merge_cnt++;
+  }
+
+  block->head = batch[0]->sector + sector_cnt;
+  block->stats.dispatch_cnt++;
+  return batch_cnt;
+}
+
+/* I/O thread for the block device BLOCK_.  Carries out queued
+   requests in the order the I/O scheduler picks, merging
+   requests for adjacent sectors into one transfer through a
+   bounce buffer, and reports their completion. */
+static void io_thread(void *block_) {
+  struct block *block = block_;
+  uint8_t *bounce = palloc_get_multiple(
+      0, BLOCK_MERGE_MAX * BLOCK_SECTOR_SIZE / PGSIZE);
+
+  for (;;) {
+    struct block_request *batch[BLOCK_MERGE_MAX];
+    struct block_request *first;
+    size_t batch_cnt, sector_cnt;
+    size_t i;
+
+    lock_acquire(&block->queue_lock);
+    while (list_empty(&block->queue))
+      cond_wait(&block->queue_ready, &block->queue_lock);
+    batch_cnt = take_batch(block, bounce != NULL, batch);
+    lock_release(&block->queue_lock);
+
+    first = batch[0];
+    if (batch_cnt == 1) {
+      if (first->write)
+        block_write_multiple(block, first->sector, first->cnt, first->buffer);
+      else
+        block_read_multiple(block, first->sector, first->cnt, first->buffer);
+    } else if (first->write) {
+      for (i = sector_cnt = 0; i < batch_cnt; sector_cnt += batch[i++]->cnt)
+        memcpy(bounce + sector_cnt * BLOCK_SECTOR_SIZE, batch[i]->buffer,
+               batch[i]->cnt * BLOCK_SECTOR_SIZE);
+      block_write_multiple(block, first->sector, sector_cnt, bounce);
+    } else {
+      for (i = sector_cnt = 0; i < batch_cnt; i++)
+        sector_cnt += batch[i]->cnt;
+      block_read_multiple(block, first->sector, sector_cnt, bounce);
+      for (i = sector_cnt = 0; i < batch_cnt; sector_cnt += batch[i++]->cnt)
+        memcpy(batch[i]->buffer, bounce + sector_cnt * BLOCK_SECTOR_SIZE,
+               batch[i]->cnt * BLOCK_SECTOR_SIZE);
+    }
+
+    for (i = 0; i < batch_cnt; i++) {
+      struct block_request *req = batch[i];
+      if (req->callback != NULL)
+        req->callback(req, req->aux);
+      else
+        sema_up(&req->done);
+    }
+  }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -123,6 +477,42 @@ const char *block_name(struct block *block) { return block->name; }
 /* Returns BLOCK's type. */
 enum block_type block_type(struct block *block) { return block->type; }
 
+/* Stores the statistics of the block device with index IDX, in
+   order of registration, into STATS.  Returns true if
+   successful, false if there is no such device.  The counters
+   are read without locking, so they may be slightly out of step
+   with each other. */
+bool block_get_stats(size_t idx, struct iostat *stats) {
+  struct list_elem *e;
+
+  for (e = list_begin(&all_blocks); e != list_end(&all_blocks);
+       e = list_next(e)) {
+    struct block *block = list_elem_to_block(e);
+    if (idx-- == 0) {
+      *stats = block->stats;
+      strlcpy(stats->name, block->name, sizeof stats->name);
+      strlcpy(stats->role, block_type_name(block->type), sizeof stats->role);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Prints the nonzero buckets of histogram H, which has CNT
+   buckets, on a line headed by NAME and TITLE.  Bucket I is
+   labeled as PREFIX followed by I. */
+static void print_histogram(const char *name, const char *title,
+                            const char *prefix, const unsigned *h,
+                            size_t cnt) {
+  size_t i;
+
+  printf("%s %s:", name, title);
+  for (i = 0; i < cnt; i++)
+    if (h[i] != 0)
+      printf(" %s%zu=%u", prefix, i, h[i]);
+  printf("\n");
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void block_print_stats(void) {
   int i;
@@ -130,8 +520,26 @@ void block_print_stats(void) {
   for (i = 0; i < BLOCK_ROLE_CNT; i++) {
     struct block *block = block_by_role[i];
     if (block != NULL) {
+      const struct iostat *stats = &block->stats;
+
       printf("%s (%s): %llu reads, %llu writes\n", block->name,
-             block_type_name(block->type), block->read_cnt, block->write_cnt);
+             block_type_name(block->type), stats->read_cnt, stats->write_cnt);
+      if (stats->transfer_cnt == 0)
+        continue;
+      printf("%s: %llu bytes read, %llu bytes written, %llu transfers, "
+             "%llu cycles each\n",
+             block->name, stats->read_bytes, stats->write_bytes,
+             stats->transfer_cnt, stats->busy_cycles / stats->transfer_cnt);
+      print_histogram(block->name, "latency", "2^", stats->latency,
+                      IOSTAT_LATENCY_CNT);
+      if (stats->request_cnt > 0) {
+        printf("%s queue (%s): %llu requests, %llu merged, "
+               "%llu transfers, max depth %zu\n",
+               block->name, iosched->name, stats->request_cnt,
+               stats->merge_cnt, stats->dispatch_cnt, block->max_queue_len);
+        print_histogram(block->name, "queue depth", "", stats->depth,
+                        IOSTAT_DEPTH_CNT);
+      }
     }
   }
 }
@@ -154,8 +562,15 @@ struct block *block_register(const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset(&block->stats, 0, sizeof block->stats);
+  lock_init(&block->queue_lock);
+  list_init(&block->queue);
+  list_init(&block->fifo);
+  block->queue_len = 0;
+  block->head = 0;
+  cond_init(&block->queue_ready);
+  block->io_thread_started = false;
+  block->max_queue_len = 0;
 
   printf("%s: %'" PRDSNu " sectors (", block->name, block->size);
   print_human_readable_size((uint64_t)block->size * BLOCK_SECTOR_SIZE);
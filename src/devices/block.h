@@ -1,7 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include "threads/synch.h"
 #include <inttypes.h>
+#include <iostat.h>
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 /* Size of a block device sector in bytes.
@@ -52,17 +56,55 @@ struct block *block_next(struct block *);
 block_sector_t block_size(struct block *);
 void block_read(struct block *, block_sector_t, void *);
 void block_write(struct block *, block_sector_t, const void *);
+void block_read_multiple(struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple(struct block *, block_sector_t, size_t cnt,
+                          const void *);
 const char *block_name(struct block *);
 enum block_type block_type(struct block *);
 
+/* Asynchronous requests. */
+struct block_request;
+typedef void block_callback_func(struct block_request *, void *aux);
+
+/* A request to transfer CNT consecutive sectors between a block
+   device and BUFFER, which the device's I/O thread carries out
+   while the submitter continues. */
+struct block_request {
+  struct list_elem elem;         /* Element in the device's queue. */
+  struct list_elem fifo_elem;    /* Element in the device's FIFO. */
+  int64_t deadline;              /* Timer tick to dispatch it by. */
+  bool write;                    /* Write to the device, or read from it? */
+  block_sector_t sector;         /* First sector. */
+  size_t cnt;                    /* Number of sectors. */
+  void *buffer;                  /* CNT * BLOCK_SECTOR_SIZE bytes. */
+  block_callback_func *callback; /* Called on completion, or null. */
+  void *aux;                     /* Passed to CALLBACK. */
+  struct semaphore done;         /* Up'd on completion if no CALLBACK. */
+};
+
+void block_request_init(struct block_request *, bool write, block_sector_t,
+                        size_t cnt, void *buffer, block_callback_func *,
+                        void *aux);
+void block_submit(struct block *, struct block_request *);
+void block_wait(struct block_request *);
+bool block_set_scheduler(const char *name);
+
 /* Statistics. */
+bool block_get_stats(size_t idx, struct iostat *);
 void block_print_stats(void);
 
 /* Lower-level interface to block device drivers. */
 
+/* Operations on a block device.  READ_MULTIPLE and
+   WRITE_MULTIPLE transfer CNT consecutive sectors at once; a
+   driver may leave them null, in which case the block layer
+   calls READ or WRITE once per sector. */
 struct block_operations {
   void (*read)(void *aux, block_sector_t, void *buffer);
   void (*write)(void *aux, block_sector_t, const void *buffer);
+  void (*read_multiple)(void *aux, block_sector_t, size_t cnt, void *buffer);
+  void (*write_multiple)(void *aux, block_sector_t, size_t cnt,
+                         const void *buffer);
 };
 
 struct block *block_register(const char *name, enum block_type,
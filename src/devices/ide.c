@@ -1,10 +1,13 @@
 #include "devices/ide.h"
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 #include <ctype.h>
 #include <debug.h>
 #include <stdbool.h>
@@ -34,6 +37,21 @@
 #define STA_BSY 0x80  /* Busy. */
 #define STA_DRDY 0x40 /* Device Ready. */
 #define STA_DRQ 0x08  /* Data Request. */
+#define STA_ERR 0x01  /* Error. */
+
+/* Bus master IDE registers, relative to the channel's bus master
+   base port (see find_bus_master()). */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01 /* Start/stop bus master operation. */
+#define BM_CMD_READ 0x08  /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits.  Writing 1 clears them. */
+#define BM_STA_ERR 0x02  /* Error. */
+#define BM_STA_INTR 0x04 /* Interrupt. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04 /* Software Reset. */
@@ -49,6 +67,21 @@
 #define CMD_IDENTIFY_DEVICE 0xec    /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20  /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30 /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4      /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5     /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6  /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8           /* READ DMA. */
+#define CMD_WRITE_DMA 0xca          /* WRITE DMA. */
+
+/* A physical region descriptor, one entry in the table that
+   tells the bus master where in memory to transfer data. */
+struct prd {
+  uint32_t addr;  /* Physical address of the region. */
+  uint16_t size;  /* Size of the region in bytes; 0 means 64 kB. */
+  uint16_t flags; /* PRD_EOT in the table's last entry. */
+};
+
+#define PRD_EOT 0x8000 /* End of table. */
 
 /* An ATA device. */
 struct ata_disk {
@@ -56,6 +89,9 @@ struct ata_disk {
   struct channel *channel; /* Channel that disk is attached to. */
   int dev_no;              /* Device 0 or 1 for master or slave. */
   bool is_ata;             /* Is device an ATA disk? */
+  int multiple_cnt;        /* Sectors per interrupt for READ/WRITE
+                              MULTIPLE, or 0 if not enabled. */
+  bool dma;                /* Transfer data by bus master DMA? */
 };
 
 /* An ATA channel (aka controller).
@@ -70,6 +106,9 @@ struct channel {
                                any interrupt would be spurious. */
   struct semaphore completion_wait; /* Up'd by interrupt handler. */
 
+  uint16_t bm_base;      /* Bus master base port, 0 if no DMA. */
+  struct prd *prd_table; /* Page-aligned PRD table for DMA. */
+
   struct ata_disk devices[2]; /* The devices on this channel. */
 };
 
@@ -79,14 +118,16 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master(void);
 static void reset_channel(struct channel *);
 static bool check_device_type(struct ata_disk *);
 static void identify_ata_device(struct ata_disk *);
+static void set_multiple_mode(struct ata_disk *, const uint16_t *id);
 
-static void select_sector(struct ata_disk *, block_sector_t);
+static void select_sector(struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command(struct channel *, uint8_t command);
-static void input_sector(struct channel *, void *);
-static void output_sector(struct channel *, const void *);
+static void input_sectors(struct channel *, void *, size_t cnt);
+static void output_sectors(struct channel *, const void *, size_t cnt);
 
 static void wait_until_idle(const struct ata_disk *);
 static bool wait_while_busy(const struct ata_disk *);
@@ -97,6 +138,7 @@ static void interrupt_handler(struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
 void ide_init(void) {
+  uint16_t bm_base = find_bus_master();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -120,6 +162,12 @@ void ide_init(void) {
     lock_init(&c->lock);
     c->expecting_interrupt = false;
     sema_init(&c->completion_wait, 0);
+    c->bm_base = 0;
+    c->prd_table = NULL;
+    if (bm_base != 0) {
+      c->bm_base = bm_base + chan_no * 8;
+      c->prd_table = palloc_get_page(PAL_ASSERT);
+    }
 
     /* Initialize devices. */
     for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -128,6 +176,8 @@ void ide_init(void) {
       d->channel = c;
       d->dev_no = dev_no;
       d->is_ata = false;
+      d->multiple_cnt = 0;
+      d->dma = false;
     }
 
     /* Register interrupt handler. */
@@ -149,6 +199,33 @@ void ide_init(void) {
 
 /* Disk detection and identification. */
 
+/* Looks for a PCI IDE controller that can act as a bus master,
+   enables bus mastering on it, and returns the base I/O port of
+   its bus master registers.  The primary channel's registers
+   start there and the secondary channel's 8 ports later.
+   Returns 0 if there is no such controller, in which case disks
+   are accessed in PIO mode only. */
+static uint16_t find_bus_master(void) {
+  struct pci_func f;
+  uint32_t bar4, command;
+
+  /* Mass storage controller, IDE.  Bit 7 of the programming
+     interface says whether it supports bus mastering. */
+  if (!pci_find_class(0x01, 0x01, &f) ||
+      (pci_read_config(&f, PCI_REG_CLASS) & 0x8000) == 0)
+    return 0;
+
+  /* The bus master registers are in I/O space, at BAR4. */
+  bar4 = pci_read_config(&f, PCI_REG_BAR0 + 4 * 4);
+  if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+    return 0;
+
+  command = pci_read_config(&f, PCI_REG_COMMAND);
+  pci_write_config(&f, PCI_REG_COMMAND,
+                   command | PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+  return bar4 & 0xfffc;
+}
+
 static char *descramble_ata_string(char *, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -255,7 +332,7 @@ static void identify_ata_device(struct ata_disk *d) {
     d->is_ata = false;
     return;
   }
-  input_sector(c, id);
+  input_sectors(c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -278,12 +355,44 @@ static void identify_ata_device(struct ata_disk *d) {
     return;
   }
 
+  /* Transfer several sectors per interrupt, if possible, and use
+     DMA if both the controller and the disk support it (word 49
+     bit 8). */
+  set_multiple_mode(d, (const uint16_t *)id);
+  d->dma = c->bm_base != 0 && (((const uint16_t *)id)[49] & 0x100) != 0;
+
   /* Register. */
   block = block_register(d->name, BLOCK_RAW, extra_info, capacity,
                          &ide_operations, d);
   partition_scan(block);
 }
 
+/* Enables READ MULTIPLE and WRITE MULTIPLE on disk D, which
+   transfer a block of sectors per interrupt instead of one,
+   using the largest block size that D's IDENTIFY DEVICE data ID
+   allows.  Leaves them disabled if D does not support them or
+   rejects the SET MULTIPLE MODE command. */
+static void set_multiple_mode(struct ata_disk *d, const uint16_t *id) {
+  struct channel *c = d->channel;
+  int max_cnt = id[47] & 0xff;
+  int cnt;
+
+  /* The block size must be a power of 2. */
+  for (cnt = 1; cnt * 2 <= max_cnt; cnt *= 2)
+    continue;
+  if (max_cnt == 0 || cnt == 1)
+    return;
+
+  select_device_wait(d);
+  outb(reg_nsect(c), cnt);
+  issue_pio_command(c, CMD_SET_MULTIPLE_MODE);
+  sema_down(&c->completion_wait);
+  wait_while_busy(d);
+  if (inb(reg_status(c)) & STA_ERR)
+    return;
+  d->multiple_cnt = cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -308,53 +417,212 @@ static char *descramble_ata_string(char *string, int size) {
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Maximum number of sectors transferred by one command.  A
+   sector count register value of 0 means 256. */
+#define IDE_MAX_SECTORS 256
+
+/* Reads CNT sectors, at most IDE_MAX_SECTORS, starting at SEC_NO
+   from disk D into BUFFER in PIO mode, with a single command.
+   The command takes one interrupt per sector or, with READ
+   MULTIPLE, one per block of D's multiple_cnt sectors.  D's
+   channel must be locked. */
+static void pio_read(struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+                     uint8_t *buffer) {
+  struct channel *c = d->channel;
+  size_t block_cnt = d->multiple_cnt > 0 ? d->multiple_cnt : 1;
+  size_t i;
+
+  select_sector(d, sec_no, cnt);
+  issue_pio_command(c, block_cnt > 1 ? CMD_READ_MULTIPLE
+                                     : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i += block_cnt) {
+    /* The disk interrupts once each block is ready. */
+    sema_down(&c->completion_wait);
+    if (!wait_while_busy(d))
+      PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no + i);
+    input_sectors(c, buffer + i * BLOCK_SECTOR_SIZE,
+                  cnt - i < block_cnt ? cnt - i : block_cnt);
+  }
+}
+
+/* Writes CNT sectors, at most IDE_MAX_SECTORS, starting at SEC_NO
+   to disk D from BUFFER in PIO mode, with a single command.
+   The command takes one interrupt per sector or, with WRITE
+   MULTIPLE, one per block of D's multiple_cnt sectors.  D's
+   channel must be locked. */
+static void pio_write(struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+                      const uint8_t *buffer) {
+  struct channel *c = d->channel;
+  size_t block_cnt = d->multiple_cnt > 0 ? d->multiple_cnt : 1;
+  size_t i;
+
+  select_sector(d, sec_no, cnt);
+  issue_pio_command(c, block_cnt > 1 ? CMD_WRITE_MULTIPLE
+                                     : CMD_WRITE_SECTOR_RETRY);
+  for (i = 0; i < cnt; i += block_cnt) {
+    /* The disk interrupts once it is ready for the next block,
+       and once more after the last one. */
+    if (i > 0)
+      sema_down(&c->completion_wait);
+    if (!wait_while_busy(d))
+      PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no + i);
+    output_sectors(c, buffer + i * BLOCK_SECTOR_SIZE,
+                   cnt - i < block_cnt ? cnt - i : block_cnt);
+  }
+  sema_down(&c->completion_wait);
+}
+
+/* Fills channel C's PRD table to describe the SIZE bytes at
+   BUFFER, which must be in kernel memory, with one region per
+   page so that no region crosses a 64 kB boundary. */
+static void build_prd_table(struct channel *c, const uint8_t *buffer,
+                            size_t size) {
+  struct prd *prd = c->prd_table;
+
+  ASSERT(size > 0);
+  while (size > 0) {
+    size_t chunk = PGSIZE - pg_ofs(buffer);
+    if (chunk > size)
+      chunk = size;
+
+    prd->addr = vtop(buffer);
+    prd->size = chunk;
+    prd->flags = 0;
+    prd++;
+
+    buffer += chunk;
+    size -= chunk;
+  }
+  prd[-1].flags = PRD_EOT;
+}
+
+/* Transfers CNT sectors, at most IDE_MAX_SECTORS, starting at
+   SEC_NO between disk D and BUFFER by bus master DMA, reading
+   from the disk if WRITE is false and writing to it otherwise.
+   The CPU is free to run other threads until the single
+   completion interrupt.  D's channel must be locked.
+   Returns true if successful, false if the controller or the
+   disk reported an error. */
+static bool dma_transfer(struct ata_disk *d, block_sector_t sec_no,
+                         size_t cnt, const uint8_t *buffer, bool write) {
+  struct channel *c = d->channel;
+  uint8_t bm_status, status;
+
+  build_prd_table(c, buffer, cnt * BLOCK_SECTOR_SIZE);
+  outl(reg_bm_prdt(c), vtop(c->prd_table));
+  outb(reg_bm_command(c), write ? 0 : BM_CMD_READ);
+  outb(reg_bm_status(c), inb(reg_bm_status(c)) | BM_STA_ERR | BM_STA_INTR);
+
+  select_sector(d, sec_no, cnt);
+  issue_pio_command(c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb(reg_bm_command(c), inb(reg_bm_command(c)) | BM_CMD_START);
+  sema_down(&c->completion_wait);
+
+  outb(reg_bm_command(c), inb(reg_bm_command(c)) & ~BM_CMD_START);
+  bm_status = inb(reg_bm_status(c));
+  outb(reg_bm_status(c), bm_status | BM_STA_ERR | BM_STA_INTR);
+  status = inb(reg_status(c));
+  return (bm_status & BM_STA_ERR) == 0 && (status & STA_ERR) == 0;
+}
+
+/* Transfers CNT sectors, at most IDE_MAX_SECTORS, starting at
+   SEC_NO between disk D and BUFFER, by DMA if D supports it and
+   otherwise in PIO mode.  If a DMA transfer fails, turns DMA off
+   for D and retries in PIO mode.  D's channel must be locked. */
+static void transfer(struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+                     const uint8_t *buffer, bool write) {
+  if (d->dma) {
+    if (dma_transfer(d, sec_no, cnt, buffer, write))
+      return;
+    printf("%s: DMA failed, sector=%" PRDSNu ", falling back to PIO\n",
+           d->name, sec_no);
+    d->dma = false;
+  }
+
+  if (write)
+    pio_write(d, sec_no, cnt, buffer);
+  else
+    pio_read(d, sec_no, cnt, (uint8_t *)buffer);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Each
+   group of up to IDE_MAX_SECTORS sectors is read with a single
+   command.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_read(void *d_, block_sector_t sec_no, void *buffer) {
+static void ide_read_multiple(void *d_, block_sector_t sec_no, size_t cnt,
+                              void *buffer_) {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_READ_SECTOR_RETRY);
-  sema_down(&c->completion_wait);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no);
-  input_sector(c, buffer);
+  while (cnt > 0) {
+    size_t n = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+
+    transfer(d, sec_no, n, buffer, false);
+    sec_no += n;
+    buffer += n * BLOCK_SECTOR_SIZE;
+    cnt -= n;
+  }
   lock_release(&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Each group
+   of up to IDE_MAX_SECTORS sectors is written with a single
+   command.  Returns after the disk has acknowledged receiving
+   the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_write(void *d_, block_sector_t sec_no, const void *buffer) {
+static void ide_write_multiple(void *d_, block_sector_t sec_no, size_t cnt,
+                               const void *buffer_) {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
-  output_sector(c, buffer);
-  sema_down(&c->completion_wait);
+  while (cnt > 0) {
+    size_t n = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+
+    transfer(d, sec_no, n, buffer, true);
+    sec_no += n;
+    buffer += n * BLOCK_SECTOR_SIZE;
+    cnt -= n;
+  }
   lock_release(&c->lock);
 }
 
-static struct block_operations ide_operations = {ide_read, ide_write};
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void ide_read(void *d, block_sector_t sec_no, void *buffer) {
+  ide_read_multiple(d, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void ide_write(void *d, block_sector_t sec_no, const void *buffer) {
+  ide_write_multiple(d, sec_no, 1, buffer);
+}
+
+static struct block_operations ide_operations = {
+    ide_read, ide_write, ide_read_multiple, ide_write_multiple};
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void select_sector(struct ata_disk *d, block_sector_t sec_no) {
+   writes SEC_NO and the sector count CNT, which must be between
+   1 and IDE_MAX_SECTORS, to the disk's sector selection
+   registers.  (We use LBA mode.) */
+static void select_sector(struct ata_disk *d, block_sector_t sec_no,
+                          size_t cnt) {
   struct channel *c = d->channel;
 
   ASSERT(sec_no < (1UL << 28));
+  ASSERT(cnt > 0 && cnt <= IDE_MAX_SECTORS);
 
   select_device_wait(d);
-  outb(reg_nsect(c), 1);
+  outb(reg_nsect(c), cnt == IDE_MAX_SECTORS ? 0 : cnt);
   outb(reg_lbal(c), sec_no);
   outb(reg_lbam(c), sec_no >> 8);
   outb(reg_lbah(c), (sec_no >> 16));
@@ -373,16 +641,19 @@ static void issue_pio_command(struct channel *c, uint8_t command) {
   outb(reg_command(c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
-static void input_sector(struct channel *c, void *sector) {
-  insw(reg_data(c), sector, BLOCK_SECTOR_SIZE / 2);
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void input_sectors(struct channel *c, void *sectors, size_t cnt) {
+  insw(reg_data(c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
-static void output_sector(struct channel *c, const void *sector) {
-  outsw(reg_data(c), sector, BLOCK_SECTOR_SIZE / 2);
+/* Writes CNT sectors from SECTORS to channel C's data register
+   in PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void output_sectors(struct channel *c, const void *sectors,
+                           size_t cnt) {
+  outsw(reg_data(c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
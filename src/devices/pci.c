@@ -0,0 +1,57 @@
+#include "devices/pci.h"
+#include "threads/io.h"
+#include <debug.h>
+
+/* Access to PCI configuration space through configuration
+   mechanism #1, which every PC chipset since the Pentium
+   supports: write the address of a 32-bit configuration
+   register to PCI_CONFIG_ADDRESS, then read or write it through
+   PCI_CONFIG_DATA.  Only as much as the IDE driver needs to find
+   its bus master registers is implemented. */
+
+#define PCI_CONFIG_ADDRESS 0xcf8 /* Configuration address port. */
+#define PCI_CONFIG_DATA 0xcfc    /* Configuration data port. */
+
+/* Selects configuration register REG of function F. */
+static void select_register(const struct pci_func *f, int reg) {
+  ASSERT(reg >= 0 && reg < 256 && reg % 4 == 0);
+  outl(PCI_CONFIG_ADDRESS, 0x80000000 | (f->bus << 16) | (f->dev << 11) |
+                               (f->func << 8) | reg);
+}
+
+/* Returns configuration register REG of function F. */
+uint32_t pci_read_config(const struct pci_func *f, int reg) {
+  select_register(f, reg);
+  return inl(PCI_CONFIG_DATA);
+}
+
+/* Sets configuration register REG of function F to VALUE. */
+void pci_write_config(const struct pci_func *f, int reg, uint32_t value) {
+  select_register(f, reg);
+  outl(PCI_CONFIG_DATA, value);
+}
+
+/* Searches the PCI buses for the first function with the given
+   CLASS and SUBCLASS.  If one is found, stores its location into
+   *F and returns true.  Otherwise, returns false. */
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_func *f) {
+  for (f->bus = 0; f->bus < 256; f->bus++)
+    for (f->dev = 0; f->dev < 32; f->dev++) {
+      int func_cnt = 1;
+
+      for (f->func = 0; f->func < func_cnt; f->func++) {
+        uint32_t class_reg;
+
+        if ((pci_read_config(f, PCI_REG_ID) & 0xffff) == 0xffff)
+          continue;
+        if (f->func == 0 && (pci_read_config(f, PCI_REG_HEADER) & 0x800000))
+          func_cnt = 8;
+
+        class_reg = pci_read_config(f, PCI_REG_CLASS);
+        if ((class_reg >> 24) == class &&
+            ((class_reg >> 16) & 0xff) == subclass)
+          return true;
+      }
+    }
+  return false;
+}
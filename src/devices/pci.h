@@ -0,0 +1,29 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Location of a function on the PCI bus. */
+struct pci_func {
+  int bus;  /* Bus number, 0...255. */
+  int dev;  /* Device number, 0...31. */
+  int func; /* Function number, 0...7. */
+};
+
+/* Configuration space registers. */
+#define PCI_REG_ID 0x00      /* Device ID 31:16, vendor ID 15:0. */
+#define PCI_REG_COMMAND 0x04 /* Status 31:16, command 15:0. */
+#define PCI_REG_CLASS 0x08   /* Class 31:24, subclass 23:16, prog IF 15:8. */
+#define PCI_REG_HEADER 0x0c  /* Header type in 23:16. */
+#define PCI_REG_BAR0 0x10    /* First base address register. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001         /* Respond to I/O space accesses. */
+#define PCI_CMD_BUS_MASTER 0x0004 /* Allow bus mastering. */
+
+uint32_t pci_read_config(const struct pci_func *, int reg);
+void pci_write_config(const struct pci_func *, int reg, uint32_t);
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_func *);
+
+#endif /* devices/pci.h */
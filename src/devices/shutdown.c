@@ -9,6 +9,9 @@
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
+#ifdef VM
+#include "vm/swap.h"
+#endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
@@ -124,4 +127,7 @@ static void print_stats(void) {
 #ifdef USERPROG
   exception_print_stats();
 #endif
+#ifdef VM
+  swap_print_stats();
+#endif
 }
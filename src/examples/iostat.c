@@ -0,0 +1,41 @@
+/* iostat.c
+
+   Prints I/O statistics for every block device: how much data
+   was transferred, how long transfers took, and how deep the
+   request queue got.  Latencies are in TSC cycles, grouped by
+   powers of 2. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+static void print_histogram(const char *title, const char *prefix,
+                            const unsigned *h, int cnt) {
+  int i;
+
+  printf("  %s:", title);
+  for (i = 0; i < cnt; i++)
+    if (h[i] != 0)
+      printf(" %s%d=%u", prefix, i, h[i]);
+  printf("\n");
+}
+
+int main(void) {
+  struct iostat stats;
+  int dev;
+
+  for (dev = 0; iostat(dev, &stats); dev++) {
+    printf("%s (%s): %llu bytes read, %llu bytes written\n", stats.name,
+           stats.role, stats.read_bytes, stats.write_bytes);
+    if (stats.transfer_cnt == 0)
+      continue;
+    printf("  %llu transfers, %llu cycles each\n", stats.transfer_cnt,
+           stats.busy_cycles / stats.transfer_cnt);
+    print_histogram("latency", "2^", stats.latency, IOSTAT_LATENCY_CNT);
+    if (stats.request_cnt > 0) {
+      printf("  %llu requests, %llu merged, %llu dispatches\n",
+             stats.request_cnt, stats.merge_cnt, stats.dispatch_cnt);
+      print_histogram("queue depth", "", stats.depth, IOSTAT_DEPTH_CNT);
+    }
+  }
+  return EXIT_SUCCESS;
+}
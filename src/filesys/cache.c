@@ -0,0 +1,340 @@
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include <debug.h>
+#include <string.h>
+
+/* The buffer cache sits between the file system and fs_device.
+   It holds up to CACHE_SIZE sectors, writes dirty sectors back
+   only when they are evicted or flushed, and picks victims with
+   the clock algorithm.  Once more than CACHE_DIRTY_HIGH sectors
+   are dirty, writers flush the cache themselves, which bounds
+   the amount of unwritten data. */
+
+/* Dirty sector count above which writers are throttled. */
+#define CACHE_DIRTY_HIGH (CACHE_SIZE * 3 / 4)
+
+/* Maximum number of consecutive sectors that cache_flush()
+   writes with a single request. */
+#define CACHE_MERGE_MAX (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A cached sector. */
+struct cache_entry {
+  block_sector_t sector; /* Sector held by this entry. */
+  bool in_use;           /* Does this entry hold a sector? */
+  bool accessed;         /* Used since the clock hand last passed? */
+  int pin_cnt;           /* Number of users; never evicted if nonzero. */
+
+  struct lock lock; /* Protects the members below. */
+  bool valid;       /* Has DATA been filled in? */
+  bool dirty;       /* Does DATA differ from the disk? */
+  uint8_t *data;    /* BLOCK_SECTOR_SIZE bytes of sector data. */
+};
+
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the sector, in_use, accessed and pin_cnt members of
+   every entry, as well as clock_hand and dirty_cnt. */
+static struct lock cache_lock;
+
+/* Signaled when an entry's pin_cnt drops to 0. */
+static struct condition cache_unpinned;
+
+/* Next entry examined by the clock algorithm. */
+static size_t clock_hand;
+
+/* Number of dirty entries. */
+static size_t dirty_cnt;
+
+/* Sectors queued for the read-ahead thread.  Requests that
+   arrive while the queue is full are dropped, since read-ahead
+   is only a hint. */
+#define READ_AHEAD_QUEUE_SIZE 64
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE_SIZE];
+static size_t read_ahead_head; /* Index of the oldest request. */
+static size_t read_ahead_cnt;  /* Number of queued requests. */
+static struct lock read_ahead_lock;
+static struct condition read_ahead_queued;
+
+size_t cache_read_ahead_window = 8;
+
+static thread_func read_ahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache. */
+void cache_init(void) {
+  size_t page_cnt = CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE;
+  uint8_t *data = palloc_get_multiple(PAL_ASSERT, page_cnt);
+  size_t i;
+
+  lock_init(&cache_lock);
+  cond_init(&cache_unpinned);
+  for (i = 0; i < CACHE_SIZE; i++) {
+    struct cache_entry *e = &cache[i];
+    e->in_use = false;
+    e->accessed = false;
+    e->pin_cnt = 0;
+    lock_init(&e->lock);
+    e->valid = false;
+    e->dirty = false;
+    e->data = data + i * BLOCK_SECTOR_SIZE;
+  }
+  clock_hand = 0;
+  dirty_cnt = 0;
+
+  lock_init(&read_ahead_lock);
+  cond_init(&read_ahead_queued);
+  read_ahead_head = read_ahead_cnt = 0;
+  thread_create("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Writes every dirty sector back to disk.  Called when the file
+   system shuts down. */
+void cache_done(void) { cache_flush(); }
+
+/* Returns the entry that holds SECTOR, or a null pointer if
+   SECTOR is not cached.  Must be called with cache_lock held. */
+static struct cache_entry *cache_lookup(block_sector_t sector) {
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an unpinned entry with the clock algorithm, writes it
+   back to disk if it is dirty, and returns it.  Waits for an
+   entry to be unpinned if every entry is in use.  Must be called
+   with cache_lock held, which is released during the write-back
+   and while waiting. */
+static struct cache_entry *cache_evict(void) {
+  for (;;) {
+    size_t i;
+
+    for (i = 0; i < 2 * CACHE_SIZE; i++) {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (e->pin_cnt > 0)
+        continue;
+      if (e->in_use && e->accessed) {
+        e->accessed = false;
+        continue;
+      }
+
+      /* Write a dirty victim back before it changes sectors, so
+         that a later miss on the old sector reads current data.
+         Other threads may use the cache meanwhile: pinning the
+         victim keeps it from being evicted twice, and a hit on
+         its sector waits on its lock.  Such a hit marks the
+         entry accessed, and a writer dirties it again, so the
+         entry is only taken if neither happened. */
+      if (e->in_use && e->dirty) {
+        e->pin_cnt++;
+        lock_release(&cache_lock);
+        lock_acquire(&e->lock);
+        if (e->dirty) {
+          block_write(fs_device, e->sector, e->data);
+          e->dirty = false;
+          lock_acquire(&cache_lock);
+          dirty_cnt--;
+          lock_release(&cache_lock);
+        }
+        lock_release(&e->lock);
+        lock_acquire(&cache_lock);
+        if (--e->pin_cnt > 0)
+          continue;
+        if (e->accessed || e->dirty) {
+          cond_signal(&cache_unpinned, &cache_lock);
+          continue;
+        }
+      }
+
+      /* An unpinned entry cannot be locked by anyone else, so it
+         is safe to reset it here. */
+      e->in_use = false;
+      e->valid = false;
+      e->dirty = false;
+      return e;
+    }
+    cond_wait(&cache_unpinned, &cache_lock);
+  }
+}
+
+/* Returns the entry for SECTOR, locked and pinned, reading the
+   sector from disk if necessary.  If OVERWRITE is true, the
+   caller promises to overwrite the whole sector, so the read is
+   skipped.  Release the entry with cache_put(). */
+static struct cache_entry *cache_get(block_sector_t sector, bool overwrite) {
+  struct cache_entry *e;
+
+  lock_acquire(&cache_lock);
+  e = cache_lookup(sector);
+  if (e == NULL) {
+    struct cache_entry *victim = cache_evict();
+
+    /* Another thread may have brought SECTOR in while
+       cache_evict() released cache_lock.  If so, the victim is
+       left free for whoever is waiting for an entry. */
+    e = cache_lookup(sector);
+    if (e == NULL) {
+      e = victim;
+      e->sector = sector;
+      e->in_use = true;
+    } else
+      cond_signal(&cache_unpinned, &cache_lock);
+  }
+  e->pin_cnt++;
+  e->accessed = true;
+  lock_release(&cache_lock);
+
+  lock_acquire(&e->lock);
+  if (!e->valid) {
+    if (!overwrite)
+      block_read(fs_device, sector, e->data);
+    e->valid = true;
+  }
+  return e;
+}
+
+/* Unlocks and unpins E, which must have been obtained from
+   cache_get(). */
+static void cache_put(struct cache_entry *e) {
+  lock_release(&e->lock);
+
+  lock_acquire(&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_signal(&cache_unpinned, &cache_lock);
+  lock_release(&cache_lock);
+}
+
+/* Reads SIZE bytes starting at byte SECTOR_OFS of SECTOR into
+   BUFFER. */
+void cache_read_at(block_sector_t sector, void *buffer, int sector_ofs,
+                   int size) {
+  struct cache_entry *e;
+
+  ASSERT(sector_ofs >= 0 && size >= 0);
+  ASSERT(sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get(sector, false);
+  memcpy(buffer, e->data + sector_ofs, size);
+  cache_put(e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte
+   SECTOR_OFS.  The data reaches the disk when the sector is
+   evicted or flushed, or right away if too much of the cache is
+   already dirty. */
+void cache_write_at(block_sector_t sector, const void *buffer, int sector_ofs,
+                    int size) {
+  struct cache_entry *e;
+  bool throttle = false;
+
+  ASSERT(sector_ofs >= 0 && size >= 0);
+  ASSERT(sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get(sector, sector_ofs == 0 && size == BLOCK_SECTOR_SIZE);
+  memcpy(e->data + sector_ofs, buffer, size);
+  if (!e->dirty) {
+    e->dirty = true;
+    lock_acquire(&cache_lock);
+    throttle = ++dirty_cnt > CACHE_DIRTY_HIGH;
+    lock_release(&cache_lock);
+  }
+  cache_put(e);
+
+  if (throttle)
+    cache_flush();
+}
+
+/* Writes every dirty sector in the cache back to disk, in
+   ascending sector order.  Runs of consecutive sectors are
+   merged into single requests, up to CACHE_MERGE_MAX sectors
+   each. */
+void cache_flush(void) {
+  struct cache_entry *batch[CACHE_SIZE];
+  size_t batch_cnt = 0;
+  uint8_t *bounce;
+  size_t run;
+  size_t i, j;
+
+  /* Pin the dirty entries, sorting them by sector. */
+  lock_acquire(&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++) {
+    struct cache_entry *e = &cache[i];
+    if (!e->in_use || !e->dirty)
+      continue;
+    e->pin_cnt++;
+    for (j = batch_cnt; j > 0 && batch[j - 1]->sector > e->sector; j--)
+      batch[j] = batch[j - 1];
+    batch[j] = e;
+    batch_cnt++;
+  }
+  lock_release(&cache_lock);
+
+  /* Write them back.  Entries are locked in ascending sector
+     order, so concurrent flushes cannot deadlock.  Without a
+     bounce buffer, each sector is written on its own. */
+  bounce = palloc_get_page(0);
+  for (i = 0; i < batch_cnt; i += run) {
+    block_sector_t first = batch[i]->sector;
+
+    for (run = 0; i + run < batch_cnt && run < CACHE_MERGE_MAX; run++) {
+      struct cache_entry *e = batch[i + run];
+      if (e->sector != first + run || (run > 0 && bounce == NULL))
+        break;
+      lock_acquire(&e->lock);
+      if (bounce != NULL)
+        memcpy(bounce + run * BLOCK_SECTOR_SIZE, e->data, BLOCK_SECTOR_SIZE);
+    }
+    block_write_multiple(fs_device, first, run,
+                         bounce != NULL ? bounce : batch[i]->data);
+
+    for (j = i; j < i + run; j++) {
+      struct cache_entry *e = batch[j];
+      if (e->dirty) {
+        e->dirty = false;
+        lock_acquire(&cache_lock);
+        dirty_cnt--;
+        lock_release(&cache_lock);
+      }
+      cache_put(e);
+    }
+  }
+  palloc_free_page(bounce);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background.  Returns without waiting for the read. */
+void cache_read_ahead(block_sector_t sector) {
+  lock_acquire(&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_QUEUE_SIZE) {
+    size_t tail = (read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE_SIZE;
+    read_ahead_queue[tail] = sector;
+    read_ahead_cnt++;
+    cond_signal(&read_ahead_queued, &read_ahead_lock);
+  }
+  lock_release(&read_ahead_lock);
+}
+
+/* Read-ahead thread.  Loads queued sectors into the cache, so
+   that readers overlap disk latency with computation. */
+static void read_ahead_daemon(void *aux UNUSED) {
+  for (;;) {
+    block_sector_t sector;
+
+    lock_acquire(&read_ahead_lock);
+    while (read_ahead_cnt == 0)
+      cond_wait(&read_ahead_queued, &read_ahead_lock);
+    sector = read_ahead_queue[read_ahead_head];
+    read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE_SIZE;
+    read_ahead_cnt--;
+    lock_release(&read_ahead_lock);
+
+    cache_put(cache_get(sector, false));
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include "devices/block.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Number of sectors held in the buffer cache. */
+#define CACHE_SIZE 64
+
+/* Number of sectors to prefetch ahead of a sequential reader.
+   Controlled by kernel command-line option "-ra=SECTORS". */
+extern size_t cache_read_ahead_window;
+
+void cache_init(void);
+void cache_done(void);
+
+void cache_read_at(block_sector_t, void *buffer, int sector_ofs, int size);
+void cache_write_at(block_sector_t, const void *buffer, int sector_ofs,
+                    int size);
+void cache_flush(void);
+void cache_read_ahead(block_sector_t);
+
+#endif /* filesys/cache.h */
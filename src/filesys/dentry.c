@@ -0,0 +1,155 @@
+#include "filesys/dentry.h"
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+
+/* The dentry cache remembers the results of recent directory
+   lookups, mapping a directory's inode sector and a name within
+   it to the inode sector the name refers to.  It also remembers
+   names that were not found ("negative" entries, with sector 0,
+   which is never a file's inode), so that repeated failing
+   lookups do not read the directory either.  Entries are
+   replaced in least-recently-used order. */
+
+/* A cached lookup result. */
+struct dentry {
+  block_sector_t parent;      /* Directory's inode sector. */
+  char name[NAME_MAX + 1];    /* Name within the directory. */
+  block_sector_t sector;      /* Inode sector of NAME, or 0. */
+  struct hash_elem hash_elem; /* Element in dentries. */
+  struct list_elem lru_elem;  /* Element in lru_list. */
+};
+
+static struct hash dentries;    /* Cached entries. */
+static struct list lru_list;    /* Entries, most recently used first. */
+static struct lock dentry_lock; /* Protects the above. */
+
+/* Hash and comparison functions for dentries. */
+static unsigned dentry_hash(const struct hash_elem *e, void *aux UNUSED) {
+  const struct dentry *d = hash_entry(e, struct dentry, hash_elem);
+  return hash_string(d->name) ^ hash_int(d->parent);
+}
+
+static bool dentry_less(const struct hash_elem *a, const struct hash_elem *b,
+                        void *aux UNUSED) {
+  const struct dentry *x = hash_entry(a, struct dentry, hash_elem);
+  const struct dentry *y = hash_entry(b, struct dentry, hash_elem);
+
+  if (x->parent != y->parent)
+    return x->parent < y->parent;
+  return strcmp(x->name, y->name) < 0;
+}
+
+/* Initializes the dentry cache. */
+void dentry_init(void) {
+  hash_init(&dentries, dentry_hash, dentry_less, NULL);
+  list_init(&lru_list);
+  lock_init(&dentry_lock);
+}
+
+/* Returns the entry for NAME in PARENT, or a null pointer if
+   there is none.  Must be called with dentry_lock held. */
+static struct dentry *find(block_sector_t parent, const char *name) {
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy(key.name, name, sizeof key.name);
+  e = hash_find(&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry(e, struct dentry, hash_elem) : NULL;
+}
+
+/* Removes D from the cache and frees it.  Must be called with
+   dentry_lock held. */
+static void discard(struct dentry *d) {
+  hash_delete(&dentries, &d->hash_elem);
+  list_remove(&d->lru_elem);
+  free(d);
+}
+
+/* Looks up NAME in the directory whose inode is in sector
+   PARENT.  If the result is cached, stores the sector of NAME's
+   inode, or 0 if NAME is known not to exist, into *SECTORP and
+   returns true.  Otherwise returns false. */
+bool dentry_lookup(block_sector_t parent, const char *name,
+                   block_sector_t *sectorp) {
+  struct dentry *d;
+
+  if (strlen(name) > NAME_MAX)
+    return false;
+
+  lock_acquire(&dentry_lock);
+  d = find(parent, name);
+  if (d != NULL) {
+    list_remove(&d->lru_elem);
+    list_push_front(&lru_list, &d->lru_elem);
+    *sectorp = d->sector;
+  }
+  lock_release(&dentry_lock);
+
+  return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   PARENT refers to the inode in SECTOR, or does not exist if
+   SECTOR is 0. */
+void dentry_insert(block_sector_t parent, const char *name,
+                   block_sector_t sector) {
+  struct dentry *d;
+
+  if (strlen(name) > NAME_MAX)
+    return;
+
+  lock_acquire(&dentry_lock);
+  d = find(parent, name);
+  if (d == NULL) {
+    if (hash_size(&dentries) >= DENTRY_CACHE_SIZE)
+      discard(list_entry(list_back(&lru_list), struct dentry, lru_elem));
+    d = malloc(sizeof *d);
+    if (d != NULL) {
+      d->parent = parent;
+      strlcpy(d->name, name, sizeof d->name);
+      hash_insert(&dentries, &d->hash_elem);
+      list_push_front(&lru_list, &d->lru_elem);
+    }
+  }
+  if (d != NULL)
+    d->sector = sector;
+  lock_release(&dentry_lock);
+}
+
+/* Forgets anything cached about NAME in the directory whose
+   inode is in sector PARENT.  Called whenever that name is added
+   or removed. */
+void dentry_invalidate(block_sector_t parent, const char *name) {
+  struct dentry *d;
+
+  if (strlen(name) > NAME_MAX)
+    return;
+
+  lock_acquire(&dentry_lock);
+  d = find(parent, name);
+  if (d != NULL)
+    discard(d);
+  lock_release(&dentry_lock);
+}
+
+/* Forgets every name cached for the directory whose inode is in
+   sector PARENT.  Called when a new directory is created in that
+   sector, since the old entries belong to a deleted directory. */
+void dentry_invalidate_dir(block_sector_t parent) {
+  struct list_elem *e, *next;
+
+  lock_acquire(&dentry_lock);
+  for (e = list_begin(&lru_list); e != list_end(&lru_list); e = next) {
+    struct dentry *d = list_entry(e, struct dentry, lru_elem);
+    next = list_next(e);
+    if (d->parent == parent)
+      discard(d);
+  }
+  lock_release(&dentry_lock);
+}
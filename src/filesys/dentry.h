@@ -0,0 +1,18 @@
+#ifndef FILESYS_DENTRY_H
+#define FILESYS_DENTRY_H
+
+#include "devices/block.h"
+#include <stdbool.h>
+
+/* Number of name lookups remembered by the dentry cache. */
+#define DENTRY_CACHE_SIZE 256
+
+void dentry_init(void);
+bool dentry_lookup(block_sector_t parent, const char *name,
+                   block_sector_t *sectorp);
+void dentry_insert(block_sector_t parent, const char *name,
+                   block_sector_t sector);
+void dentry_invalidate(block_sector_t parent, const char *name);
+void dentry_invalidate_dir(block_sector_t parent);
+
+#endif /* filesys/dentry.h */
@@ -1,11 +1,29 @@
 #include "filesys/directory.h"
+#include "filesys/dentry.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include <hash.h>
 #include <list.h>
 #include <stdio.h>
 #include <string.h>
 
+/* A directory's file is a hash table of directory entries with
+   open addressing.  The entry for a name lives in one of the
+   DIR_MAX_PROBE slots that follow (cyclically) the slot its hash
+   selects, so lookup, add and remove each read at most
+   DIR_MAX_PROBE entries.  Removed entries are simply marked
+   unused; since lookup always examines the whole probe window,
+   no tombstones are needed.  When a name's window is full, the
+   table is doubled in size and every entry is rehashed. */
+
+/* Number of slots examined for a name. */
+#define DIR_MAX_PROBE 8
+
+/* Smallest number of slots in a directory that has entries. */
+#define DIR_MIN_ENTRIES 16
+
 /* A directory. */
 struct dir {
   struct inode *inode; /* Backing store. */
@@ -22,9 +40,27 @@ struct dir_entry {
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool dir_create(block_sector_t sector, size_t entry_cnt) {
+  dentry_invalidate_dir(sector);
   return inode_create(sector, entry_cnt * sizeof(struct dir_entry));
 }
 
+/* Returns the number of slots in DIR's hash table. */
+static size_t slot_cnt(const struct dir *dir) {
+  return inode_length(dir->inode) / sizeof(struct dir_entry);
+}
+
+/* Returns the Ith slot to probe for NAME in a table of SLOTS
+   slots. */
+static size_t probe(const char *name, size_t i, size_t slots) {
+  return (hash_string(name) + i) % slots;
+}
+
+/* Returns the number of slots to probe in a table of SLOTS
+   slots. */
+static size_t probe_cnt(size_t slots) {
+  return slots < DIR_MAX_PROBE ? slots : DIR_MAX_PROBE;
+}
+
 /* Opens and returns the directory for the given INODE, of which
    it takes ownership.  Returns a null pointer on failure. */
 struct dir *dir_open(struct inode *inode) {
@@ -71,37 +107,120 @@ struct inode *dir_get_inode(struct dir *dir) { return dir->inode; }
 static bool lookup(const struct dir *dir, const char *name,
                    struct dir_entry *ep, off_t *ofsp) {
   struct dir_entry e;
-  size_t ofs;
+  size_t slots = slot_cnt(dir);
+  size_t i;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
-  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp(name, e.name)) {
+  for (i = 0; i < probe_cnt(slots); i++) {
+    off_t ofs = probe(name, i, slots) * sizeof e;
+    if (inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e && e.in_use &&
+        !strcmp(name, e.name)) {
       if (ep != NULL)
         *ep = e;
       if (ofsp != NULL)
         *ofsp = ofs;
       return true;
     }
+  }
   return false;
 }
 
+/* Stores E into a free slot of TABLE, an in-memory hash table of
+   SLOTS slots.  Returns true if successful, false if E's probe
+   window is full. */
+static bool table_insert(struct dir_entry *table, size_t slots,
+                         const struct dir_entry *e) {
+  size_t i;
+
+  for (i = 0; i < probe_cnt(slots); i++) {
+    struct dir_entry *slot = &table[probe(e->name, i, slots)];
+    if (!slot->in_use) {
+      *slot = *e;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Rehashes DIR into a table with at least twice as many slots,
+   large enough that every entry fits in its probe window.  The
+   new table is written to a fresh inode whose contents then
+   replace DIR's, so DIR is left as it was if the disk fills up.
+   Returns true if successful, false on a disk or memory error. */
+static bool grow(struct dir *dir) {
+  size_t old_slots = slot_cnt(dir);
+  size_t slots = old_slots * 2 > DIR_MIN_ENTRIES ? old_slots * 2
+                                                  : DIR_MIN_ENTRIES;
+  off_t old_size = old_slots * sizeof(struct dir_entry);
+  struct dir_entry *old = malloc(old_size > 0 ? old_size : 1);
+  struct dir_entry *table = NULL;
+  struct inode *fresh;
+  block_sector_t sector;
+  off_t size;
+  bool success = false;
+  size_t i;
+
+  if (old == NULL || inode_read_at(dir->inode, old, old_size, 0) != old_size)
+    goto done;
+
+  for (;;) {
+    table = calloc(slots, sizeof *table);
+    if (table == NULL)
+      goto done;
+    for (i = 0; i < old_slots; i++)
+      if (old[i].in_use && !table_insert(table, slots, &old[i]))
+        break;
+    if (i == old_slots)
+      break;
+    free(table);
+    slots *= 2;
+  }
+
+  if (!free_map_allocate(1, &sector))
+    goto done;
+  if (!inode_create(sector, 0) || (fresh = inode_open(sector)) == NULL) {
+    free_map_release(sector, 1);
+    goto done;
+  }
+  size = slots * sizeof *table;
+  success = inode_write_at(fresh, table, size, 0) == size;
+  if (success)
+    inode_exchange(dir->inode, fresh);
+
+  /* Frees DIR's old contents, or the partial new table. */
+  inode_remove(fresh);
+  inode_close(fresh);
+
+done:
+  free(table);
+  free(old);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
    a null pointer.  The caller must close *INODE. */
 bool dir_lookup(const struct dir *dir, const char *name, struct inode **inode) {
+  block_sector_t parent, sector;
   struct dir_entry e;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
-  if (lookup(dir, name, &e, NULL))
-    *inode = inode_open(e.inode_sector);
-  else
-    *inode = NULL;
+  /* Consult the dentry cache first, and remember what the
+     directory says if the cache does not know. */
+  parent = inode_get_inumber(dir->inode);
+  inode_lock(dir->inode);
+  if (!dentry_lookup(parent, name, &sector)) {
+    sector = lookup(dir, name, &e, NULL) ? e.inode_sector : 0;
+    dentry_insert(parent, name, sector);
+  }
+  inode_unlock(dir->inode);
+
+  *inode = sector != 0 ? inode_open(sector) : NULL;
 
   return *inode != NULL;
 }
@@ -124,29 +243,40 @@ bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector) {
   if (*name == '\0' || strlen(name) > NAME_MAX)
     return false;
 
+  inode_lock(dir->inode);
+
   /* Check that NAME is not in use. */
   if (lookup(dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
+  /* Set OFS to the offset of a free slot in NAME's probe
+     window, growing the table until there is one. */
+  for (;;) {
+    size_t slots = slot_cnt(dir);
+    size_t i;
+
+    for (i = 0; i < probe_cnt(slots); i++) {
+      ofs = probe(name, i, slots) * sizeof e;
+      if (inode_read_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
+        goto done;
+      if (!e.in_use)
+        break;
+    }
+    if (i < probe_cnt(slots))
       break;
+    if (!grow(dir))
+      goto done;
+  }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy(e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+  dentry_invalidate(inode_get_inumber(dir->inode), name);
 
 done:
+  inode_unlock(dir->inode);
   return success;
 }
 
@@ -162,6 +292,8 @@ bool dir_remove(struct dir *dir, const char *name) {
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
+  inode_lock(dir->inode);
+
   /* Find directory entry. */
   if (!lookup(dir, name, &e, &ofs))
     goto done;
@@ -177,10 +309,12 @@ bool dir_remove(struct dir *dir, const char *name) {
     goto done;
 
   /* Remove inode. */
+  dentry_invalidate(inode_get_inumber(dir->inode), name);
   inode_remove(inode);
   success = true;
 
 done:
+  inode_unlock(dir->inode);
   inode_close(inode);
   return success;
 }
@@ -190,13 +324,17 @@ done:
    contains no more entries. */
 bool dir_readdir(struct dir *dir, char name[NAME_MAX + 1]) {
   struct dir_entry e;
+  bool found = false;
 
+  inode_lock(dir->inode);
   while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
     dir->pos += sizeof e;
     if (e.in_use) {
       strlcpy(name, e.name, NAME_MAX + 1);
-      return true;
+      found = true;
+      break;
     }
   }
-  return false;
+  inode_unlock(dir->inode);
+  return found;
 }
@@ -1,8 +1,12 @@
 #include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/dentry.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "threads/thread.h"
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
@@ -10,7 +14,12 @@
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Interval between background flushes of the buffer cache,
+   in timer ticks. */
+#define FLUSH_INTERVAL (3 * TIMER_FREQ)
+
 static void do_format(void);
+static thread_func flush_daemon NO_RETURN;
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -19,6 +28,8 @@ void filesys_init(bool format) {
   if (fs_device == NULL)
     PANIC("No file system device found, can't initialize file system.");
 
+  cache_init();
+  dentry_init();
   inode_init();
   free_map_init();
 
@@ -26,11 +37,16 @@ void filesys_init(bool format) {
     do_format();
 
   free_map_open();
+
+  thread_create("flusher", PRI_DEFAULT, flush_daemon, NULL);
 }
 
 /* Shuts down the file system module, writing any unwritten data
    to disk. */
-void filesys_done(void) { free_map_close(); }
+void filesys_done(void) {
+  free_map_close();
+  cache_done();
+}
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
@@ -77,6 +93,17 @@ bool filesys_remove(const char *name) {
   return success;
 }
 
+/* Flusher thread.  Periodically writes dirty sectors back to
+   disk, so that little unwritten data is left for filesys_done()
+   and small random writes reach the disk as sorted batches. */
+static void flush_daemon(void *aux UNUSED) {
+  for (;;) {
+    timer_sleep(FLUSH_INTERVAL);
+    free_map_flush();
+    cache_flush();
+  }
+}
+
 /* Formats the file system. */
 static void do_format(void) {
   printf("Formatting file system...");
@@ -2,43 +2,358 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <limits.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
 
 static struct file *free_map_file; /* Free map file. */
 static struct bitmap *free_map;    /* Free map, one bit per sector. */
+static struct lock free_map_lock;  /* Protects everything in this file. */
+
+/* Changes to the free map are written back lazily, by
+   free_map_flush().  DIRTY_SECTORS has one bit per sector of the
+   free map file, set if that part of FREE_MAP has changed since
+   it was last written. */
+static struct bitmap *dirty_sectors;
+
+/* Number of free map bits stored in one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * CHAR_BIT)
+
+/* The bitmap is what is kept on disk.  In memory, the free
+   sectors are also indexed as maximal runs ("extents") so that
+   allocation does not have to scan the bitmap:
+
+     - by start sector and by end sector, in hash tables, which
+       find the extent that begins at a given sector and merge
+       released sectors with their free neighbors in O(1);
+
+     - by size, in segregated lists: class K holds the extents
+       of 2**K to 2**(K+1) - 1 sectors.  A request is served from
+       the head of the first non-empty class whose extents are
+       all large enough, which costs O(log disk size) class
+       probes.  Only if there is none is the one class that may
+       hold both larger and smaller extents searched. */
+
+/* A run of free sectors. */
+struct extent {
+  block_sector_t start;        /* First free sector. */
+  size_t cnt;                  /* Number of free sectors. */
+  struct hash_elem start_elem; /* Element in extents_by_start. */
+  struct hash_elem end_elem;   /* Element in extents_by_end. */
+  struct list_elem size_elem;  /* Element in a size class list. */
+};
+
+/* Number of size classes. */
+#define SIZE_CLASS_CNT (sizeof(size_t) * CHAR_BIT)
+
+static struct hash extents_by_start;
+static struct hash extents_by_end;
+static struct list size_classes[SIZE_CLASS_CNT];
+
+static void build_extents(void);
+
+/* Returns the size class for an extent of CNT sectors. */
+static size_t size_class(size_t cnt) {
+  size_t class = 0;
+
+  ASSERT(cnt > 0);
+  while (cnt >>= 1)
+    class++;
+  return class;
+}
+
+/* Hash and comparison functions for extents_by_start. */
+static unsigned extent_start_hash(const struct hash_elem *e,
+                                  void *aux UNUSED) {
+  return hash_int(hash_entry(e, struct extent, start_elem)->start);
+}
+
+static bool extent_start_less(const struct hash_elem *a,
+                              const struct hash_elem *b, void *aux UNUSED) {
+  return hash_entry(a, struct extent, start_elem)->start <
+         hash_entry(b, struct extent, start_elem)->start;
+}
+
+/* Hash and comparison functions for extents_by_end.  An
+   extent's end is the sector just past its last free sector. */
+static unsigned extent_end_hash(const struct hash_elem *e, void *aux UNUSED) {
+  const struct extent *x = hash_entry(e, struct extent, end_elem);
+  return hash_int(x->start + x->cnt);
+}
+
+static bool extent_end_less(const struct hash_elem *a,
+                            const struct hash_elem *b, void *aux UNUSED) {
+  const struct extent *x = hash_entry(a, struct extent, end_elem);
+  const struct extent *y = hash_entry(b, struct extent, end_elem);
+  return x->start + x->cnt < y->start + y->cnt;
+}
+
+/* Returns the free extent that starts at SECTOR, or a null
+   pointer if there is none. */
+static struct extent *extent_starting_at(block_sector_t sector) {
+  struct extent key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  e = hash_find(&extents_by_start, &key.start_elem);
+  return e != NULL ? hash_entry(e, struct extent, start_elem) : NULL;
+}
+
+/* Returns the free extent that ends just before SECTOR, or a
+   null pointer if there is none. */
+static struct extent *extent_ending_at(block_sector_t sector) {
+  struct extent key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  key.cnt = 0;
+  e = hash_find(&extents_by_end, &key.end_elem);
+  return e != NULL ? hash_entry(e, struct extent, end_elem) : NULL;
+}
+
+/* Adds X to the indexes. */
+static void extent_insert(struct extent *x) {
+  hash_insert(&extents_by_start, &x->start_elem);
+  hash_insert(&extents_by_end, &x->end_elem);
+  list_push_front(&size_classes[size_class(x->cnt)], &x->size_elem);
+}
+
+/* Removes X from the indexes. */
+static void extent_remove(struct extent *x) {
+  hash_delete(&extents_by_start, &x->start_elem);
+  hash_delete(&extents_by_end, &x->end_elem);
+  list_remove(&x->size_elem);
+}
+
+/* Returns a free extent of at least CNT sectors, or a null
+   pointer if there is none.  Takes the first extent in the
+   smallest class where every extent fits: any class above CNT's
+   own, and CNT's own too if CNT is a power of 2.  Failing that,
+   searches CNT's class, which is linear in its length but only
+   happens when no larger extent is free. */
+static struct extent *find_fit(size_t cnt) {
+  size_t first = size_class(cnt);
+  size_t class;
+  struct list_elem *e;
+
+  class = (cnt & (cnt - 1)) == 0 ? first : first + 1;
+  for (; class < SIZE_CLASS_CNT; class++)
+    if (!list_empty(&size_classes[class]))
+      return list_entry(list_front(&size_classes[class]), struct extent,
+                        size_elem);
+
+  for (e = list_begin(&size_classes[first]);
+       e != list_end(&size_classes[first]); e = list_next(e)) {
+    struct extent *x = list_entry(e, struct extent, size_elem);
+    if (x->cnt >= cnt)
+      return x;
+  }
+  return NULL;
+}
+
+/* Returns the largest free extent, or a null pointer if the disk
+   is full. */
+static struct extent *largest(void) {
+  size_t class;
+
+  for (class = SIZE_CLASS_CNT; class-- > 0;)
+    if (!list_empty(&size_classes[class])) {
+      struct extent *best = NULL;
+      struct list_elem *e;
+
+      for (e = list_begin(&size_classes[class]);
+           e != list_end(&size_classes[class]); e = list_next(e)) {
+        struct extent *x = list_entry(e, struct extent, size_elem);
+        if (best == NULL || x->cnt > best->cnt)
+          best = x;
+      }
+      return best;
+    }
+  return NULL;
+}
+
+/* Marks CNT sectors starting at SECTOR as used or free in
+   FREE_MAP, according to USED, and notes which parts of the free
+   map file need to be written. */
+static void set_used(block_sector_t sector, size_t cnt, bool used) {
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple(free_map, sector, cnt, used);
+  bitmap_set_multiple(dirty_sectors, first, last - first + 1, true);
+}
+
+/* Takes the first CNT sectors of X, which must have at least
+   that many, out of the free map.  Returns the first sector
+   taken. */
+static block_sector_t take_from(struct extent *x, size_t cnt) {
+  block_sector_t sector = x->start;
+
+  ASSERT(cnt > 0 && cnt <= x->cnt);
+  extent_remove(x);
+  x->start += cnt;
+  x->cnt -= cnt;
+  if (x->cnt > 0)
+    extent_insert(x);
+  else
+    free(x);
+
+  set_used(sector, cnt, true);
+  return sector;
+}
+
+/* Returns CNT sectors starting at SECTOR to the free extents,
+   merging them with their free neighbors.  Does not touch the
+   bitmap. */
+static void give_back(block_sector_t sector, size_t cnt) {
+  struct extent *prev = extent_ending_at(sector);
+  struct extent *next = extent_starting_at(sector + cnt);
+
+  if (prev != NULL) {
+    extent_remove(prev);
+    prev->cnt += cnt;
+    if (next != NULL) {
+      extent_remove(next);
+      prev->cnt += next->cnt;
+      free(next);
+    }
+    extent_insert(prev);
+  } else if (next != NULL) {
+    extent_remove(next);
+    next->start = sector;
+    next->cnt += cnt;
+    extent_insert(next);
+  } else {
+    struct extent *x = malloc(sizeof *x);
+    if (x == NULL)
+      PANIC("free map: out of memory for extent index");
+    x->start = sector;
+    x->cnt = cnt;
+    extent_insert(x);
+  }
+}
 
 /* Initializes the free map. */
 void free_map_init(void) {
+  size_t i;
+
+  lock_init(&free_map_lock);
+  hash_init(&extents_by_start, extent_start_hash, extent_start_less, NULL);
+  hash_init(&extents_by_end, extent_end_hash, extent_end_less, NULL);
+  for (i = 0; i < SIZE_CLASS_CNT; i++)
+    list_init(&size_classes[i]);
+
   free_map = bitmap_create(block_size(fs_device));
   if (free_map == NULL)
     PANIC("bitmap creation failed--file system device is too large");
+  dirty_sectors = bitmap_create(
+      DIV_ROUND_UP(bitmap_size(free_map), BITS_PER_SECTOR));
+  if (dirty_sectors == NULL)
+    PANIC("bitmap creation failed--file system device is too large");
   bitmap_mark(free_map, FREE_MAP_SECTOR);
   bitmap_mark(free_map, ROOT_DIR_SECTOR);
+  build_extents();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  Uses a free extent from the smallest
+   size class that satisfies the request; see find_fit().
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool free_map_allocate(size_t cnt, block_sector_t *sectorp) {
-  block_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR && free_map_file != NULL &&
-      !bitmap_write(free_map, free_map_file)) {
-    bitmap_set_multiple(free_map, sector, cnt, false);
-    sector = BITMAP_ERROR;
+  struct extent *x;
+
+  lock_acquire(&free_map_lock);
+  x = cnt > 0 ? find_fit(cnt) : NULL;
+  if (x != NULL)
+    *sectorp = take_from(x, cnt);
+  lock_release(&free_map_lock);
+
+  return x != NULL;
+}
+
+/* Allocates between 1 and CNT consecutive sectors, for growing a
+   file.  If GOAL is not 0 and starts a free extent, the sectors
+   are taken from there, so that a file's data stays physically
+   sequential.  Otherwise uses a free extent with CNT sectors as
+   find_fit() chooses it, or failing that the largest free
+   extent.
+   Stores the first sector into *SECTORP and returns the number
+   of sectors allocated, which is 0 if the disk is full. */
+size_t free_map_allocate_extent(block_sector_t goal, size_t cnt,
+                                block_sector_t *sectorp) {
+  struct extent *x = NULL;
+
+  ASSERT(cnt > 0);
+
+  lock_acquire(&free_map_lock);
+  if (goal != 0)
+    x = extent_starting_at(goal);
+  if (x == NULL)
+    x = find_fit(cnt);
+  if (x == NULL)
+    x = largest();
+  if (x != NULL) {
+    if (cnt > x->cnt)
+      cnt = x->cnt;
+    *sectorp = take_from(x, cnt);
   }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release(&free_map_lock);
+
+  return x != NULL ? cnt : 0;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void free_map_release(block_sector_t sector, size_t cnt) {
+  lock_acquire(&free_map_lock);
   ASSERT(bitmap_all(free_map, sector, cnt));
-  bitmap_set_multiple(free_map, sector, cnt, false);
-  bitmap_write(free_map, free_map_file);
+  set_used(sector, cnt, false);
+  give_back(sector, cnt);
+  lock_release(&free_map_lock);
+}
+
+/* Writes the parts of the free map that have changed since the
+   last flush to disk, merging adjacent dirty sectors of the free
+   map file into single writes.  Returns true if successful,
+   false if a write failed; the unwritten parts stay dirty. */
+bool free_map_flush(void) {
+  size_t sector_cnt = bitmap_size(dirty_sectors);
+  size_t start, end;
+  bool success = true;
+
+  lock_acquire(&free_map_lock);
+  if (free_map_file != NULL)
+    for (start = bitmap_scan(dirty_sectors, 0, 1, true);
+         start != BITMAP_ERROR;
+         start = bitmap_scan(dirty_sectors, end, 1, true)) {
+      size_t first_bit, last_bit;
+
+      end = bitmap_scan(dirty_sectors, start, 1, false);
+      if (end == BITMAP_ERROR)
+        end = sector_cnt;
+
+      first_bit = start * BITS_PER_SECTOR;
+      last_bit = end * BITS_PER_SECTOR;
+      if (last_bit > bitmap_size(free_map))
+        last_bit = bitmap_size(free_map);
+      if (bitmap_write_range(free_map, free_map_file, first_bit,
+                             last_bit - first_bit))
+        bitmap_set_multiple(dirty_sectors, start, end - start, false);
+      else
+        success = false;
+
+      if (end == sector_cnt)
+        break;
+    }
+  lock_release(&free_map_lock);
+
+  return success;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -48,10 +363,19 @@ void free_map_open(void) {
     PANIC("can't open free map");
   if (!bitmap_read(free_map, free_map_file))
     PANIC("can't read free map");
+  bitmap_set_all(dirty_sectors, false);
+  build_extents();
 }
 
 /* Writes the free map to disk and closes the free map file. */
-void free_map_close(void) { file_close(free_map_file); }
+void free_map_close(void) {
+  if (!free_map_flush())
+    printf("free map: write failed, changes lost\n");
+  lock_acquire(&free_map_lock);
+  file_close(free_map_file);
+  free_map_file = NULL;
+  lock_release(&free_map_lock);
+}
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
@@ -60,10 +384,39 @@ void free_map_create(void) {
   if (!inode_create(FREE_MAP_SECTOR, bitmap_file_size(free_map)))
     PANIC("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  This allocates the file's sectors,
+     changing the bitmap as it is written, so the changed parts
+     stay dirty until the next flush. */
   free_map_file = file_open(inode_open(FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC("can't open free map");
   if (!bitmap_write(free_map, free_map_file))
     PANIC("can't write free map");
 }
+
+/* Action function for hash_clear() that frees an extent. */
+static void free_extent(struct hash_elem *e, void *aux UNUSED) {
+  free(hash_entry(e, struct extent, start_elem));
+}
+
+/* Rebuilds the free extent index from the bitmap. */
+static void build_extents(void) {
+  size_t sector_cnt = bitmap_size(free_map);
+  size_t start, end;
+  size_t i;
+
+  hash_clear(&extents_by_end, NULL);
+  hash_clear(&extents_by_start, free_extent);
+  for (i = 0; i < SIZE_CLASS_CNT; i++)
+    list_init(&size_classes[i]);
+
+  for (start = bitmap_scan(free_map, 0, 1, false); start != BITMAP_ERROR;
+       start = bitmap_scan(free_map, end, 1, false)) {
+    end = bitmap_scan(free_map, start, 1, true);
+    if (end == BITMAP_ERROR)
+      end = sector_cnt;
+    give_back(start, end - start);
+    if (end == sector_cnt)
+      break;
+  }
+}
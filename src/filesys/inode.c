@@ -1,22 +1,45 @@
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include <debug.h>
-#include <list.h>
+#include <hash.h>
 #include <round.h>
 #include <string.h>
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of direct sector pointers in an inode. */
+#define DIRECT_CNT 123
+
+/* Number of sector pointers in an indirect block. */
+#define INDIRECT_CNT (BLOCK_SECTOR_SIZE / sizeof(block_sector_t))
+
+/* Maximum number of data sectors in an inode. */
+#define MAX_SECTORS (DIRECT_CNT + INDIRECT_CNT + INDIRECT_CNT * INDIRECT_CNT)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sectors are found through a multi-level index: the first
+   DIRECT_CNT sectors are listed in DIRECT, the next INDIRECT_CNT
+   in the indirect block, and the rest in the indirect blocks
+   listed by the doubly indirect block.  A sector number of 0
+   (the free map inode, never a data sector) marks a slot that
+   has not been allocated.
+
+   Files are sparse: data sectors are allocated when they are
+   first written, and unallocated sectors read as zeros. */
 struct inode_disk {
-  block_sector_t start; /* First data sector. */
-  off_t length;         /* File size in bytes. */
-  unsigned magic;       /* Magic number. */
-  uint32_t unused[125]; /* Not used. */
+  block_sector_t direct[DIRECT_CNT]; /* Direct data sectors. */
+  block_sector_t indirect;           /* Indirect block. */
+  block_sector_t doubly_indirect;    /* Doubly indirect block. */
+  off_t length;                      /* File size in bytes. */
+  unsigned magic;                    /* Magic number. */
+  uint32_t unused[1];                /* Not used. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -25,40 +48,239 @@ static inline size_t bytes_to_sectors(off_t size) {
   return DIV_ROUND_UP(size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* The part of an inode that open_inodes is keyed on, so that a
+   lookup needs no more than this on the stack. */
+struct inode_key {
+  struct hash_elem elem; /* Element in open_inodes. */
+  block_sector_t sector; /* Sector number of disk location. */
+};
+
+/* In-memory inode.
+
+   RWLOCK protects DATA, which includes the sector index, and
+   DENY_WRITE_CNT: readers of the file hold it for reading, and
+   writers, which may extend the index, for writing.  LOCK is
+   held by users of the inode's contents that need a larger
+   critical section than one read or write, such as directory
+   updates; see inode_lock(). */
 struct inode {
-  struct list_elem elem;  /* Element in inode list. */
-  block_sector_t sector;  /* Sector number of disk location. */
+  struct inode_key key;   /* Element in open_inodes, and sector. */
   int open_cnt;           /* Number of openers. */
+  bool loaded;            /* Has DATA been read in? */
   bool removed;           /* True if deleted, false otherwise. */
   int deny_write_cnt;     /* 0: writes ok, >0: deny writes. */
+  off_t read_end;         /* End of the last read, to spot sequential access. */
+  off_t read_ahead_end;   /* End of the data already queued for read-ahead. */
+  struct lock ra_lock;    /* Protects read_end and read_ahead_end. */
+  struct rwlock rwlock;   /* Protects data and deny_write_cnt. */
+  struct lock lock;       /* See inode_lock(). */
   struct inode_disk data; /* Inode content. */
 };
 
+/* A sector's worth of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Allocates a sector, fills it with zeros, and stores its
+   number into *SECTORP.  Returns true if successful, false if
+   the disk is full. */
+static bool allocate_zeroed(block_sector_t *sectorp) {
+  if (!free_map_allocate(1, sectorp))
+    return false;
+  cache_write_at(*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* Returns entry IDX of the indirect block in sector
+   INDEX_SECTOR, which is 0 if the entry is unallocated. */
+static block_sector_t index_get(block_sector_t index_sector, size_t idx) {
+  block_sector_t sector;
+
+  cache_read_at(index_sector, &sector, idx * sizeof sector, sizeof sector);
+  return sector;
+}
+
+/* Sets entry IDX of the indirect block in sector INDEX_SECTOR to
+   SECTOR. */
+static void index_set(block_sector_t index_sector, size_t idx,
+                      block_sector_t sector) {
+  cache_write_at(index_sector, &sector, idx * sizeof sector, sizeof sector);
+}
+
+/* Returns the sector that holds data sector IDX of DISK_INODE,
+   or 0 if that sector is unallocated. */
+static block_sector_t index_to_sector(const struct inode_disk *disk_inode,
+                                      size_t idx) {
+  block_sector_t indirect;
+
+  if (idx < DIRECT_CNT)
+    return disk_inode->direct[idx];
+  idx -= DIRECT_CNT;
+
+  if (idx < INDIRECT_CNT)
+    return disk_inode->indirect != 0 ? index_get(disk_inode->indirect, idx)
+                                     : 0;
+  idx -= INDIRECT_CNT;
+
+  if (idx < INDIRECT_CNT * INDIRECT_CNT && disk_inode->doubly_indirect != 0) {
+    indirect = index_get(disk_inode->doubly_indirect, idx / INDIRECT_CNT);
+    if (indirect != 0)
+      return index_get(indirect, idx % INDIRECT_CNT);
+  }
+  return 0;
+}
+
+/* Records SECTOR as data sector IDX of DISK_INODE, allocating
+   the index blocks on the way to it as necessary.  DISK_INODE is
+   updated in memory only.  Returns true if successful, false if
+   an index block could not be allocated. */
+static bool index_install(struct inode_disk *disk_inode, size_t idx,
+                          block_sector_t sector) {
+  block_sector_t indirect;
+
+  if (idx < DIRECT_CNT) {
+    disk_inode->direct[idx] = sector;
+    return true;
+  }
+  idx -= DIRECT_CNT;
+
+  if (idx < INDIRECT_CNT) {
+    if (disk_inode->indirect == 0 && !allocate_zeroed(&disk_inode->indirect))
+      return false;
+    index_set(disk_inode->indirect, idx, sector);
+    return true;
+  }
+  idx -= INDIRECT_CNT;
+
+  ASSERT(idx < INDIRECT_CNT * INDIRECT_CNT);
+  if (disk_inode->doubly_indirect == 0 &&
+      !allocate_zeroed(&disk_inode->doubly_indirect))
+    return false;
+  indirect = index_get(disk_inode->doubly_indirect, idx / INDIRECT_CNT);
+  if (indirect == 0) {
+    if (!allocate_zeroed(&indirect))
+      return false;
+    index_set(disk_inode->doubly_indirect, idx / INDIRECT_CNT, indirect);
+  }
+  index_set(indirect, idx % INDIRECT_CNT, sector);
+  return true;
+}
+
+/* Allocates data sectors for up to CNT unallocated slots of
+   DISK_INODE, starting at slot IDX, which must be unallocated,
+   and stopping early at a slot that is already allocated.  The
+   sectors are taken from the free map as one extent, which
+   starts right after the data sector in slot IDX - 1 when
+   possible, so that a file written sequentially stays
+   physically sequential.  The new sectors are not zeroed.
+   DISK_INODE is updated in memory only.
+   Returns the number of sectors allocated, which is 0 if the
+   disk is full. */
+static size_t inode_allocate(struct inode_disk *disk_inode, size_t idx,
+                             size_t cnt) {
+  block_sector_t goal = 0;
+  block_sector_t sector;
+  size_t i;
+
+  ASSERT(cnt > 0);
+  ASSERT(index_to_sector(disk_inode, idx) == 0);
+
+  if (idx > 0 && (goal = index_to_sector(disk_inode, idx - 1)) != 0)
+    goal++;
+  for (i = 1; i < cnt; i++)
+    if (index_to_sector(disk_inode, idx + i) != 0)
+      break;
+
+  cnt = free_map_allocate_extent(goal, i, &sector);
+  for (i = 0; i < cnt; i++)
+    if (!index_install(disk_inode, idx + i, sector + i)) {
+      free_map_release(sector + i, cnt - i);
+      return i;
+    }
+  return cnt;
+}
+
+/* Releases the indirect block in SECTOR along with everything it
+   points to.  DEPTH is 1 for an indirect block, 2 for a doubly
+   indirect block. */
+static void release_index(block_sector_t sector, int depth) {
+  block_sector_t *entries = malloc(BLOCK_SECTOR_SIZE);
+  size_t i;
+
+  if (entries != NULL) {
+    cache_read_at(sector, entries, 0, BLOCK_SECTOR_SIZE);
+    for (i = 0; i < INDIRECT_CNT; i++)
+      if (entries[i] != 0) {
+        if (depth > 1)
+          release_index(entries[i], depth - 1);
+        else
+          free_map_release(entries[i], 1);
+      }
+    free(entries);
+  }
+  free_map_release(sector, 1);
+}
+
+/* Releases every data and index sector of DISK_INODE. */
+static void inode_release(struct inode_disk *disk_inode) {
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    if (disk_inode->direct[i] != 0)
+      free_map_release(disk_inode->direct[i], 1);
+  if (disk_inode->indirect != 0)
+    release_index(disk_inode->indirect, 1);
+  if (disk_inode->doubly_indirect != 0)
+    release_index(disk_inode->doubly_indirect, 2);
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
-static block_sector_t byte_to_sector(const struct inode *inode, off_t pos) {
+static block_sector_t byte_to_sector(struct inode *inode, off_t pos) {
   ASSERT(inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return index_to_sector(&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt and loaded members of
+   every inode. */
+static struct lock open_inodes_lock;
+
+/* Broadcast when an inode has been read in. */
+static struct condition inode_loaded;
+
+/* Hash and comparison functions for open_inodes. */
+static unsigned inode_hash(const struct hash_elem *e, void *aux UNUSED) {
+  return hash_int(hash_entry(e, struct inode_key, elem)->sector);
+}
+
+static bool inode_less(const struct hash_elem *a, const struct hash_elem *b,
+                       void *aux UNUSED) {
+  return hash_entry(a, struct inode_key, elem)->sector <
+         hash_entry(b, struct inode_key, elem)->sector;
+}
 
 /* Initializes the inode module. */
-void inode_init(void) { list_init(&open_inodes); }
+void inode_init(void) {
+  hash_init(&open_inodes, inode_hash, inode_less, NULL);
+  lock_init(&open_inodes_lock);
+  cond_init(&inode_loaded);
+}
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  No data sectors are allocated until they are
+   written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is too
+   large. */
 bool inode_create(block_sector_t sector, off_t length) {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -69,22 +291,15 @@ bool inode_create(block_sector_t sector, off_t length) {
      one sector in size, and you should fix that. */
   ASSERT(sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (bytes_to_sectors(length) > MAX_SECTORS)
+    return false;
+
   disk_inode = calloc(1, sizeof *disk_inode);
   if (disk_inode != NULL) {
-    size_t sectors = bytes_to_sectors(length);
     disk_inode->length = length;
     disk_inode->magic = INODE_MAGIC;
-    if (free_map_allocate(sectors, &disk_inode->start)) {
-      block_write(fs_device, sector, disk_inode);
-      if (sectors > 0) {
-        static char zeros[BLOCK_SECTOR_SIZE];
-        size_t i;
-
-        for (i = 0; i < sectors; i++)
-          block_write(fs_device, disk_inode->start + i, zeros);
-      }
-      success = true;
-    }
+    cache_write_at(sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+    success = true;
     free(disk_inode);
   }
   return success;
@@ -94,69 +309,109 @@ bool inode_create(block_sector_t sector, off_t length) {
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode *inode_open(block_sector_t sector) {
-  struct list_elem *e;
+  struct inode_key key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin(&open_inodes); e != list_end(&open_inodes);
-       e = list_next(e)) {
-    inode = list_entry(e, struct inode, elem);
-    if (inode->sector == sector) {
-      inode_reopen(inode);
-      return inode;
-    }
+  lock_acquire(&open_inodes_lock);
+
+  /* Check whether this inode is already open, and wait for it to
+     be read in if it was only just opened. */
+  key.sector = sector;
+  e = hash_find(&open_inodes, &key.elem);
+  if (e != NULL) {
+    inode = hash_entry(e, struct inode, key.elem);
+    inode->open_cnt++;
+    while (!inode->loaded)
+      cond_wait(&inode_loaded, &open_inodes_lock);
+    lock_release(&open_inodes_lock);
+    return inode;
   }
 
   /* Allocate memory. */
   inode = malloc(sizeof *inode);
-  if (inode == NULL)
+  if (inode == NULL) {
+    lock_release(&open_inodes_lock);
     return NULL;
+  }
 
-  /* Initialize. */
-  list_push_front(&open_inodes, &inode->elem);
-  inode->sector = sector;
+  /* Initialize, and publish the inode before reading it, so that
+     other opens and closes do not wait for the disk. */
+  inode->key.sector = sector;
   inode->open_cnt = 1;
+  inode->loaded = false;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read(fs_device, inode->sector, &inode->data);
+  inode->read_end = 0;
+  inode->read_ahead_end = 0;
+  rwlock_init(&inode->rwlock);
+  lock_init(&inode->lock);
+  lock_init(&inode->ra_lock);
+  hash_insert(&open_inodes, &inode->key.elem);
+  lock_release(&open_inodes_lock);
+
+  cache_read_at(inode->key.sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
+  lock_acquire(&open_inodes_lock);
+  inode->loaded = true;
+  cond_broadcast(&inode_loaded, &open_inodes_lock);
+  lock_release(&open_inodes_lock);
   return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *inode_reopen(struct inode *inode) {
-  if (inode != NULL)
+  if (inode != NULL) {
+    lock_acquire(&open_inodes_lock);
     inode->open_cnt++;
+    lock_release(&open_inodes_lock);
+  }
   return inode;
 }
 
 /* Returns INODE's inode number. */
 block_sector_t inode_get_inumber(const struct inode *inode) {
-  return inode->sector;
+  return inode->key.sector;
 }
 
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
 void inode_close(struct inode *inode) {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0) {
-    /* Remove from inode list and release lock. */
-    list_remove(&inode->elem);
+  /* Remove from the open inode table if this was the last
+     opener. */
+  lock_acquire(&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete(&open_inodes, &inode->key.elem);
+  lock_release(&open_inodes_lock);
 
+  /* Release resources if this was the last opener. */
+  if (last) {
     /* Deallocate blocks if removed. */
     if (inode->removed) {
-      free_map_release(inode->sector, 1);
-      free_map_release(inode->data.start, bytes_to_sectors(inode->data.length));
+      free_map_release(inode->key.sector, 1);
+      inode_release(&inode->data);
     }
 
     free(inode);
   }
 }
 
+/* Acquires INODE's lock, which serializes compound operations on
+   its contents, such as looking up a name in a directory and
+   then adding it.  Plain reads and writes do not need it. */
+void inode_lock(struct inode *inode) { lock_acquire(&inode->lock); }
+
+/* Releases INODE's lock. */
+void inode_unlock(struct inode *inode) { lock_release(&inode->lock); }
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void inode_remove(struct inode *inode) {
@@ -164,15 +419,54 @@ void inode_remove(struct inode *inode) {
   inode->removed = true;
 }
 
+/* Records a read of INODE from START to END.  If it continued
+   where the previous read left off, queues the next
+   cache_read_ahead_window sectors for read-ahead, skipping those
+   already queued. */
+static void inode_read_ahead(struct inode *inode, off_t start, off_t end) {
+  off_t window_end =
+      end + (off_t)cache_read_ahead_window * BLOCK_SECTOR_SIZE;
+  off_t from, ofs;
+
+  if (window_end > inode_length(inode))
+    window_end = inode_length(inode);
+
+  /* Claim the range to queue under ra_lock, so that concurrent
+     readers neither miss a sequential run nor queue it twice. */
+  lock_acquire(&inode->ra_lock);
+  if (start != inode->read_end) {
+    inode->read_end = end;
+    inode->read_ahead_end = 0;
+    lock_release(&inode->ra_lock);
+    return;
+  }
+  inode->read_end = end;
+  if (inode->read_ahead_end < end)
+    inode->read_ahead_end = ROUND_UP(end, BLOCK_SECTOR_SIZE);
+  from = inode->read_ahead_end;
+  if (cache_read_ahead_window > 0 && window_end > from)
+    inode->read_ahead_end = ROUND_UP(window_end, BLOCK_SECTOR_SIZE);
+  lock_release(&inode->ra_lock);
+
+  if (cache_read_ahead_window == 0)
+    return;
+  for (ofs = from; ofs < window_end; ofs += BLOCK_SECTOR_SIZE) {
+    block_sector_t sector = byte_to_sector(inode, ofs);
+    if (sector != 0)
+      cache_read_ahead(sector);
+  }
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t inode_read_at(struct inode *inode, void *buffer_, off_t size,
                     off_t offset) {
   uint8_t *buffer = buffer_;
+  off_t start = offset;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read(&inode->rwlock);
   while (size > 0) {
     /* Disk sector to read, starting byte offset within sector. */
     block_sector_t sector_idx = byte_to_sector(inode, offset);
@@ -188,52 +482,65 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size,
     if (chunk_size <= 0)
       break;
 
-    if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
-      /* Read full sector directly into caller's buffer. */
-      block_read(fs_device, sector_idx, buffer + bytes_read);
-    } else {
-      /* Read sector into bounce buffer, then partially copy
-         into caller's buffer. */
-      if (bounce == NULL) {
-        bounce = malloc(BLOCK_SECTOR_SIZE);
-        if (bounce == NULL)
-          break;
-      }
-      block_read(fs_device, sector_idx, bounce);
-      memcpy(buffer + bytes_read, bounce + sector_ofs, chunk_size);
-    }
+    /* Copy the chunk out of the buffer cache, or zeros if the
+       sector has never been written. */
+    if (sector_idx != 0)
+      cache_read_at(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+    else
+      memset(buffer + bytes_read, 0, chunk_size);
 
     /* Advance. */
     size -= chunk_size;
     offset += chunk_size;
     bytes_read += chunk_size;
   }
-  free(bounce);
+
+  /* Prefetch what a sequential reader is likely to ask for next. */
+  inode_read_ahead(inode, start, offset);
+  rwlock_release_read(&inode->rwlock);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if an error occurs.
+   A write past end of file extends the inode, leaving a hole
+   between the old end of file and OFFSET.  Data sectors are
+   allocated as they are first written.  The new length is
+   published only after the data has been written. */
 off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size,
                      off_t offset) {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t length;
+  size_t fresh_end = 0; /* End of the slots allocated by this write. */
+  bool allocated = false;
 
-  if (inode->deny_write_cnt)
+  rwlock_acquire_write(&inode->rwlock);
+  if (inode->deny_write_cnt) {
+    rwlock_release_write(&inode->rwlock);
     return 0;
+  }
+
+  /* Extend the inode if the write ends past end of file. */
+  length = inode_length(inode);
+  if (size > 0 && offset + size > length) {
+    if (bytes_to_sectors(offset + size) > MAX_SECTORS) {
+      rwlock_release_write(&inode->rwlock);
+      return 0;
+    }
+    length = offset + size;
+  }
 
   while (size > 0) {
     /* Sector to write, starting byte offset within sector. */
-    block_sector_t sector_idx = byte_to_sector(inode, offset);
+    size_t idx = offset / BLOCK_SECTOR_SIZE;
+    block_sector_t sector_idx = index_to_sector(&inode->data, idx);
     int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
     /* Bytes left in inode, bytes left in sector, lesser of the two. */
-    off_t inode_left = inode_length(inode) - offset;
+    off_t inode_left = length - offset;
     int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
     int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -242,34 +549,39 @@ off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size,
     if (chunk_size <= 0)
       break;
 
-    if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
-      /* Write full sector directly to disk. */
-      block_write(fs_device, sector_idx, buffer + bytes_written);
-    } else {
-      /* We need a bounce buffer. */
-      if (bounce == NULL) {
-        bounce = malloc(BLOCK_SECTOR_SIZE);
-        if (bounce == NULL)
-          break;
-      }
-
-      /* If the sector contains data before or after the chunk
-         we're writing, then we need to read in the sector
-         first.  Otherwise we start with a sector of all zeros. */
-      if (sector_ofs > 0 || chunk_size < sector_left)
-        block_read(fs_device, sector_idx, bounce);
-      else
-        memset(bounce, 0, BLOCK_SECTOR_SIZE);
-      memcpy(bounce + sector_ofs, buffer + bytes_written, chunk_size);
-      block_write(fs_device, sector_idx, bounce);
+    /* Allocate the sectors this write reaches first, as one
+       extent. */
+    if (sector_idx == 0) {
+      size_t cnt = inode_allocate(&inode->data, idx,
+                                  bytes_to_sectors(offset + size) - idx);
+      if (cnt == 0)
+        break;
+      allocated = true;
+      fresh_end = idx + cnt;
+      sector_idx = index_to_sector(&inode->data, idx);
     }
 
+    /* Copy the chunk into the buffer cache, which reads in the
+       rest of the sector first if the chunk does not cover it.
+       A new sector holds garbage, so zero it first instead. */
+    if (idx < fresh_end && chunk_size < BLOCK_SECTOR_SIZE)
+      cache_write_at(sector_idx, zeros, 0, BLOCK_SECTOR_SIZE);
+    cache_write_at(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+
     /* Advance. */
     size -= chunk_size;
     offset += chunk_size;
     bytes_written += chunk_size;
   }
-  free(bounce);
+
+  /* Publish the new length and index. */
+  if (bytes_written > 0 && offset > inode->data.length) {
+    inode->data.length = offset;
+    allocated = true;
+  }
+  if (allocated)
+    cache_write_at(inode->key.sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  rwlock_release_write(&inode->rwlock);
 
   return bytes_written;
 }
@@ -277,18 +589,55 @@ off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size,
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void inode_deny_write(struct inode *inode) {
+  rwlock_acquire_write(&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT(inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write(&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
    Must be called once by each inode opener who has called
    inode_deny_write() on the inode, before closing the inode. */
 void inode_allow_write(struct inode *inode) {
+  rwlock_acquire_write(&inode->rwlock);
   ASSERT(inode->deny_write_cnt > 0);
   ASSERT(inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write(&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t inode_length(const struct inode *inode) { return inode->data.length; }
+
+/* Exchanges the contents of A and B, so that each takes over the
+   other's data sectors and length.  B must be open only by the
+   caller, which can thus fill it in and then replace A's
+   contents with it in one step. */
+void inode_exchange(struct inode *a, struct inode *b) {
+  block_sector_t sector;
+  off_t length;
+  size_t i;
+
+  ASSERT(a != b);
+
+  rwlock_acquire_write(&a->rwlock);
+  rwlock_acquire_write(&b->rwlock);
+  for (i = 0; i < DIRECT_CNT; i++) {
+    sector = a->data.direct[i];
+    a->data.direct[i] = b->data.direct[i];
+    b->data.direct[i] = sector;
+  }
+  sector = a->data.indirect;
+  a->data.indirect = b->data.indirect;
+  b->data.indirect = sector;
+  sector = a->data.doubly_indirect;
+  a->data.doubly_indirect = b->data.doubly_indirect;
+  b->data.doubly_indirect = sector;
+  length = a->data.length;
+  a->data.length = b->data.length;
+  b->data.length = length;
+  cache_write_at(a->key.sector, &a->data, 0, BLOCK_SECTOR_SIZE);
+  cache_write_at(b->key.sector, &b->data, 0, BLOCK_SECTOR_SIZE);
+  rwlock_release_write(&b->rwlock);
+  rwlock_release_write(&a->rwlock);
+}
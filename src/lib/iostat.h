@@ -0,0 +1,34 @@
+#ifndef __LIB_IOSTAT_H
+#define __LIB_IOSTAT_H
+
+/* Number of buckets in a latency histogram.  Bucket I counts
+   transfers that took between 2**I and 2**(I+1) - 1 TSC cycles;
+   the last bucket also counts everything slower. */
+#define IOSTAT_LATENCY_CNT 40
+
+/* Number of buckets in a queue depth histogram.  Bucket I counts
+   requests that found I others queued ahead of them; the last
+   bucket also counts everything deeper. */
+#define IOSTAT_DEPTH_CNT 16
+
+/* I/O statistics for a block device, as returned by the iostat
+   system call. */
+struct iostat {
+  char name[16]; /* Device name, e.g. "hd0:0". */
+  char role[8];  /* Role, e.g. "filesys" or "swap". */
+
+  unsigned long long read_cnt;     /* Number of sectors read. */
+  unsigned long long write_cnt;    /* Number of sectors written. */
+  unsigned long long read_bytes;   /* Number of bytes read. */
+  unsigned long long write_bytes;  /* Number of bytes written. */
+  unsigned long long transfer_cnt; /* Number of transfers. */
+  unsigned long long busy_cycles;  /* TSC cycles spent transferring. */
+  unsigned long long request_cnt;  /* Asynchronous requests submitted. */
+  unsigned long long merge_cnt;    /* Requests merged into another. */
+  unsigned long long dispatch_cnt; /* Transfers by the I/O thread. */
+
+  unsigned latency[IOSTAT_LATENCY_CNT]; /* Transfer latency histogram. */
+  unsigned depth[IOSTAT_DEPTH_CNT];     /* Queue depth histogram. */
+};
+
+#endif /* lib/iostat.h */
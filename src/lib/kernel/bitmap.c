@@ -298,6 +298,23 @@ bool bitmap_write(const struct bitmap *b, struct file *file) {
   off_t size = byte_cnt(b->bit_cnt);
   return file_write_at(file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B's file that holds bits START through
+   START + CNT (exclusive) to FILE.  Return true if successful,
+   false otherwise. */
+bool bitmap_write_range(const struct bitmap *b, struct file *file,
+                        size_t start, size_t cnt) {
+  off_t ofs, size;
+
+  ASSERT(start <= b->bit_cnt);
+  ASSERT(start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  ofs = start / CHAR_BIT;
+  size = DIV_ROUND_UP(start + cnt, CHAR_BIT) - ofs;
+  return file_write_at(file, (const uint8_t *)b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
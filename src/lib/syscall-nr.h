@@ -29,7 +29,13 @@ enum {
   SYS_MKDIR,   /* Create a directory. */
   SYS_READDIR, /* Reads a directory entry. */
   SYS_ISDIR,   /* Tests if a fd represents a directory. */
-  SYS_INUMBER  /* Returns the inode number for a fd. */
+  SYS_INUMBER, /* Returns the inode number for a fd. */
+
+  /* Statistics. */
+  SYS_IOSTAT, /* Obtain a block device's I/O statistics. */
+
+  /* Processes. */
+  SYS_FORK /* Duplicate the current process. */
 };
 
 #endif /* lib/syscall-nr.h */
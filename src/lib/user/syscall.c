@@ -118,6 +118,12 @@ bool isdir(int fd) { return syscall1(SYS_ISDIR, fd); }
 
 int inumber(int fd) { return syscall1(SYS_INUMBER, fd); }
 
+bool iostat(int dev, struct iostat *stats) {
+  return syscall2(SYS_IOSTAT, dev, stats);
+}
+
+pid_t fork(void) { return (pid_t)syscall0(SYS_FORK); }
+
 int fibonacci(int n) { return syscall1(SYS_FIBO, n); }
 
 int max_of_four_int(int a, int b, int c, int d) {
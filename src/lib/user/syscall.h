@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <debug.h>
+#include <iostat.h>
 #include <stdbool.h>
 
 /* Process identifier. */
@@ -47,4 +48,10 @@ bool readdir(int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir(int fd);
 int inumber(int fd);
 
+/* Statistics. */
+bool iostat(int dev, struct iostat *);
+
+/* Processes. */
+pid_t fork(void);
+
 #endif /* lib/user/syscall.h */
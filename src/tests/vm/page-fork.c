@@ -0,0 +1,43 @@
+/* Forks a child, which checks that it sees its parent's memory
+   and then overwrites its copy.  The parent checks that its own
+   copy is unchanged, since pages are shared copy-on-write. */
+
+#include "tests/lib.h"
+#include "tests/main.h"
+#include <string.h>
+#include <syscall.h>
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+void test_main(void) {
+  pid_t child;
+  int status;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i * 257;
+
+  CHECK((child = fork()) != -1, "fork");
+  if (child == 0) {
+    for (i = 0; i < SIZE; i++)
+      if (buf[i] != (char)(i * 257))
+        fail("child read bad value %d at offset %zu", buf[i], i);
+    memset(buf, 0x5a, SIZE);
+    for (i = 0; i < SIZE; i++)
+      if (buf[i] != 0x5a)
+        fail("child read back bad value %d at offset %zu", buf[i], i);
+    msg("child overwrote its copy");
+    exit(0x42);
+  }
+
+  /* CHECK prints its message first, so wait before it, to keep
+     the output in order behind the child's. */
+  status = wait(child);
+  CHECK(status == 0x42, "wait for child");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char)(i * 257))
+      fail("parent read bad value %d at offset %zu", buf[i], i);
+  msg("parent's copy is unchanged");
+}
@@ -0,0 +1,106 @@
+/* Measures how much overlapping swap I/O with file system I/O
+   gains.  The same workload runs twice: 2 child-linear
+   processes, which page heavily, and repeated writes and reads
+   of a file.  The serialized run lets the children finish before
+   touching the file; the overlapped run does both at once, so
+   that swap requests on one disk and file system requests on the
+   other are in flight together.  Each run reports its elapsed
+   TSC cycles and how long each device was busy, and the file
+   must read back intact in both. */
+
+#include "tests/lib.h"
+#include "tests/main.h"
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+#define CHILD_CNT 2
+#define FILE_SIZE (128 * 1024)
+#define CHUNK_SIZE 4096
+#define ROUND_CNT 4
+
+static char chunk[CHUNK_SIZE];
+static char data[CHUNK_SIZE];
+
+/* Returns the processor's time-stamp counter. */
+static uint64_t rdtsc(void) {
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+/* Returns the busy cycles so far of the device with ROLE. */
+static uint64_t busy_cycles(const char *role) {
+  struct iostat stats;
+  int dev;
+
+  for (dev = 0; iostat(dev, &stats); dev++)
+    if (!strcmp(stats.role, role))
+      return stats.busy_cycles;
+  fail("no %s device", role);
+}
+
+/* Writes FD from start to end and reads it back, ROUND_CNT
+   times over. */
+static void file_io(int fd) {
+  int round;
+  size_t ofs, i;
+
+  for (round = 0; round < ROUND_CNT; round++) {
+    for (i = 0; i < CHUNK_SIZE; i++)
+      chunk[i] = round + i;
+
+    seek(fd, 0);
+    for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+      if (write(fd, chunk, CHUNK_SIZE) != CHUNK_SIZE)
+        fail("write %zu bytes at offset %zu failed", (size_t)CHUNK_SIZE, ofs);
+
+    seek(fd, 0);
+    for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE) {
+      if (read(fd, data, CHUNK_SIZE) != CHUNK_SIZE)
+        fail("read %zu bytes at offset %zu failed", (size_t)CHUNK_SIZE, ofs);
+      compare_bytes(data, chunk, CHUNK_SIZE, ofs, "mixed");
+    }
+  }
+}
+
+/* Runs the workload on FD, with the file I/O overlapping the
+   children's paging if OVERLAP is true, and reports the time it
+   took as NAME. */
+static void run(int fd, bool overlap, const char *name) {
+  pid_t children[CHILD_CNT];
+  uint64_t start, swap_start, fs_start;
+  uint64_t elapsed;
+  size_t i;
+
+  start = rdtsc();
+  swap_start = busy_cycles("swap");
+  fs_start = busy_cycles("filesys");
+
+  quiet = true;
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK((children[i] = exec("child-linear")) != -1, "exec \"child-linear\"");
+  if (overlap)
+    file_io(fd);
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK(wait(children[i]) == 0x42, "wait for child %zu", i);
+  if (!overlap)
+    file_io(fd);
+  quiet = false;
+
+  elapsed = rdtsc() - start;
+  msg("%s run: %llu cycles, swap busy %llu, filesys busy %llu", name,
+      elapsed, busy_cycles("swap") - swap_start,
+      busy_cycles("filesys") - fs_start);
+}
+
+void test_main(void) {
+  int fd;
+
+  CHECK(create("mixed", 0), "create \"mixed\"");
+  CHECK((fd = open("mixed")) > 1, "open \"mixed\"");
+
+  run(fd, false, "serialized");
+  run(fd, true, "overlapped");
+  close(fd);
+}
@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+
+# The figures vary from run to run, so only the shape of the
+# output is checked, and the figures are reported with the verdict.
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+my (%cycles);
+foreach (@output) {
+    next if !/^\(page-io-mix\) (\w+) run: (\d+) cycles/;
+    $cycles{$1} = $2;
+    s/\d+/N/g;
+}
+compare_output ("run", IGNORE_EXIT_CODES => 1, \@output, [<<'EOF']);
+(page-io-mix) begin
+(page-io-mix) create "mixed"
+(page-io-mix) open "mixed"
+(page-io-mix) serialized run: N cycles, swap busy N, filesys busy N
+(page-io-mix) overlapped run: N cycles, swap busy N, filesys busy N
+(page-io-mix) end
+EOF
+pass sprintf ("overlapped run took %.0f%% of the serialized run's time",
+	      100 * $cycles{overlapped} / $cycles{serialized});
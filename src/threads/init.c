@@ -28,6 +28,7 @@
 #include "userprog/process.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "vm/frame.h"
 #include "vm/swap.h"
 #else
 #include "tests/threads/tests.h"
@@ -35,6 +36,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -98,7 +100,9 @@ int main(void)
   palloc_init(user_page_limit);
   malloc_init();
   paging_init();
-  list_init(&lru_pages);
+#ifdef USERPROG
+  frame_init();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -244,6 +248,13 @@ static char **parse_options(char **argv)
       filesys_bdev_name = value;
     else if (!strcmp(name, "-scratch"))
       scratch_bdev_name = value;
+    else if (!strcmp(name, "-ra"))
+      cache_read_ahead_window = atoi(value);
+    else if (!strcmp(name, "-iosched"))
+    {
+      if (!block_set_scheduler(value))
+        PANIC("unknown I/O scheduler `%s' (use -h for help)", value);
+    }
 #ifdef VM
     else if (!strcmp(name, "-swap"))
       swap_bdev_name = value;
@@ -369,6 +380,9 @@ static void usage(void)
          "  -f                 Format file system device during startup.\n"
          "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
          "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+         "  -ra=SECTORS        Read ahead SECTORS sectors (0 to disable).\n"
+         "  -iosched=NAME      Use I/O scheduler NAME: noop, clook (default),\n"
+         "                     or deadline.\n"
 #ifdef VM
          "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
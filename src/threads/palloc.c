@@ -132,6 +132,16 @@ void palloc_free_multiple(void *pages, size_t page_cnt) {
 /* Frees the page at PAGE. */
 void palloc_free_page(void *page) { palloc_free_multiple(page, 1); }
 
+/* Returns the number of pages in the user pool. */
+size_t palloc_user_page_cnt(void) { return bitmap_size(user_pool.used_map); }
+
+/* Returns the index of PAGE within the user pool, from 0 up to
+   palloc_user_page_cnt().  PAGE must be in the user pool. */
+size_t palloc_user_page_idx(const void *page) {
+  ASSERT(page_from_pool(&user_pool, (void *)page));
+  return pg_no(page) - pg_no(user_pool.base);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void init_pool(struct pool *p, void *base, size_t page_cnt,
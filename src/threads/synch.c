@@ -330,3 +330,73 @@ void cond_broadcast(struct condition *cond, struct lock *lock) {
   while (!list_empty(&cond->waiters))
     cond_signal(cond, lock);
 }
+
+/* Initializes RWLOCK.  Any number of readers may hold a
+   readers-writer lock at once, or a single writer, but not
+   both.  Writers are preferred: once a writer is waiting, new
+   readers wait behind it, so a steady stream of readers cannot
+   starve writers. */
+void rwlock_init(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+
+  lock_init(&rwlock->lock);
+  cond_init(&rwlock->can_read);
+  cond_init(&rwlock->can_write);
+  rwlock->reader_cnt = 0;
+  rwlock->waiting_writer_cnt = 0;
+  rwlock->writing = false;
+}
+
+/* Acquires RWLOCK for reading, sleeping until no writer holds
+   it or is waiting for it. */
+void rwlock_acquire_read(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+
+  lock_acquire(&rwlock->lock);
+  while (rwlock->writing || rwlock->waiting_writer_cnt > 0)
+    cond_wait(&rwlock->can_read, &rwlock->lock);
+  rwlock->reader_cnt++;
+  lock_release(&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading. */
+void rwlock_release_read(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+
+  lock_acquire(&rwlock->lock);
+  ASSERT(rwlock->reader_cnt > 0);
+  if (--rwlock->reader_cnt == 0)
+    cond_signal(&rwlock->can_write, &rwlock->lock);
+  lock_release(&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no reader or
+   writer holds it. */
+void rwlock_acquire_write(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+
+  lock_acquire(&rwlock->lock);
+  rwlock->waiting_writer_cnt++;
+  while (rwlock->writing || rwlock->reader_cnt > 0)
+    cond_wait(&rwlock->can_write, &rwlock->lock);
+  rwlock->waiting_writer_cnt--;
+  rwlock->writing = true;
+  lock_release(&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing.  Wakes the next writer if there is one, otherwise
+   every waiting reader. */
+void rwlock_release_write(struct rwlock *rwlock) {
+  ASSERT(rwlock != NULL);
+
+  lock_acquire(&rwlock->lock);
+  ASSERT(rwlock->writing);
+  rwlock->writing = false;
+  if (rwlock->waiting_writer_cnt > 0)
+    cond_signal(&rwlock->can_write, &rwlock->lock);
+  else
+    cond_broadcast(&rwlock->can_read, &rwlock->lock);
+  lock_release(&rwlock->lock);
+}
@@ -38,6 +38,22 @@ void cond_wait(struct condition *, struct lock *);
 void cond_signal(struct condition *, struct lock *);
 void cond_broadcast(struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock {
+  struct lock lock;            /* Protects the members below. */
+  struct condition can_read;   /* Signaled when readers may enter. */
+  struct condition can_write;  /* Signaled when a writer may enter. */
+  unsigned reader_cnt;         /* Number of readers holding the lock. */
+  unsigned waiting_writer_cnt; /* Number of writers waiting. */
+  bool writing;                /* Is a writer holding the lock? */
+};
+
+void rwlock_init(struct rwlock *);
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
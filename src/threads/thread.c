@@ -198,14 +198,16 @@ tid_t thread_create(const char *name, int priority, thread_func *function,
   sf->eip = switch_entry;
   sf->ebp = 0;
 
+  /* Allocate file descriptor table before the thread can run,
+     since a forked process fills it in right away. */
+#ifdef USERPROG
+  t->fd_table = palloc_get_page(PAL_ZERO);
+#endif
+
   /* Add to run queue. */
   thread_unblock(t);
   if (thread_get_priority() < t->priority)
     thread_yield();
-/* Allocate file descriptor table*/
-#ifdef USERPROG
-  t->fd_table = palloc_get_page(PAL_ZERO);
-#endif
 
   return tid;
 }
@@ -130,6 +130,11 @@ struct thread {
   /* Proj 4*/
   struct hash vm_table;
   struct list mmap_list;
+
+  /* Swap read-around, owned by vm/swap.c. */
+  size_t swap_ra_window; /* Pages to read after a swapped-in page. */
+  void *swap_ra_start;   /* First page read around at the last swap-in. */
+  size_t swap_ra_cnt;    /* Number of pages read around then. */
 #endif
 
   /* Owned by thread.c. */
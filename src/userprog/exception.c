@@ -20,7 +20,7 @@ static long long page_fault_cnt;
 
 static void kill(struct intr_frame *);
 static void page_fault(struct intr_frame *);
-static bool page_fault_handler(struct vm_entry *entry);
+static bool page_fault_handler(struct vm_entry *entry, bool write);
 
 #define MAX_STACK_SIZE (8 * 1024 * 1024)
 /* Registers handlers for interrupts that can be caused by user
@@ -173,7 +173,9 @@ static void page_fault(struct intr_frame *f) {
             new->writable = true;
             kpage->entry = new;
             ASSERT(insert_vm_entry(&thread_current()->vm_table, new));
-          }
+            unpin_page(kpage->kaddr);
+          } else
+            free_page(kpage->kaddr);
         }
       }
 
@@ -188,7 +190,7 @@ static void page_fault(struct intr_frame *f) {
     exit(-1);
   }
   // load or swap in page
-  if (page_fault_handler(entry)) {
+  if (page_fault_handler(entry, write)) {
     return;
   }
   NOT_REACHED();
@@ -201,41 +203,54 @@ static void page_fault(struct intr_frame *f) {
   kill(f);
 }
 
-static bool page_fault_handler(struct vm_entry *entry) {
+static bool page_fault_handler(struct vm_entry *entry, bool write) {
+  struct page *kpage;
+  void *kaddr;
 
-  if (entry->type == VM_BIN || entry->type == VM_FILE) {
-    // not loaded yet so load from file and install_page
-    struct page *kpage = alloc_page(PAL_USER);
-    ASSERT(kpage);
-    /* Load this page. */
-    if (file_read_at(entry->file, kpage->kaddr, entry->read_bytes,
-                     entry->offset) != (int)entry->read_bytes) {
-      free_page(kpage->kaddr);
-      return false;
-    }
-    memset(kpage->kaddr + entry->read_bytes, 0, entry->zero_bytes);
-    if (!install_page(entry->vaddr, kpage->kaddr, entry->writable)) {
-      free_page(kpage->kaddr);
-      return false;
-    }
-    entry->is_loaded = true;
-    kpage->entry = entry;
-    return true;
-  } else if (entry->type == VM_ANON) {
-    struct page *kpage = alloc_page(PAL_USER);
-    ASSERT(kpage);
-    if (!install_page(entry->vaddr, kpage->kaddr, true)) {
-      free_page(kpage->kaddr);
-      return false;
-    }
+  /* Wait for the page to finish being evicted, if it is.  If it
+     turns out to be in memory, another fault already loaded it,
+     unless this is a write to a page shared copy-on-write. */
+  kaddr = frame_pin_entry(entry);
+  if (kaddr != NULL) {
+    unpin_page(kaddr);
+    if (!(write && entry->cow))
+      return true;
+  }
 
-    read_swap_page(entry->swap_index, kpage->kaddr);
+  /* A page shared copy-on-write since fork() stays shared until
+     it is written. */
+  if (entry->cow)
+    return write ? unshare_page(entry) : map_shared_page(entry);
 
-    entry->is_loaded = true;
+  /* Read-only pages of executables are shared with every other
+     process running the same program. */
+  if (entry->type == VM_BIN && !entry->writable)
+    return map_shared_page(entry);
 
-    kpage->entry = entry;
+  /* Every other page needs a frame of its own, which stays pinned
+     until the page is installed. */
+  kpage = alloc_page(PAL_USER);
+  ASSERT(kpage);
+  switch (entry->type) {
+  case VM_BIN:
+  case VM_FILE:
+    // not loaded yet so load from file
+    if (!load_file_page(entry, kpage)) {
+      free_page(kpage->kaddr);
+      return false;
+    }
+    break;
+  case VM_ANON:
+    swap_in(entry, kpage);
+    break;
+  }
 
-    return true;
-    // TODO
+  if (!install_page(entry->vaddr, kpage->kaddr, entry->writable)) {
+    free_page(kpage->kaddr);
+    return false;
   }
+  entry->is_loaded = true;
+  kpage->entry = entry;
+  unpin_page(kpage->kaddr);
+  return true;
 }
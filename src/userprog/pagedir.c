@@ -183,6 +183,20 @@ void pagedir_set_accessed(uint32_t *pd, const void *vpage, bool accessed) {
   }
 }
 
+/* Sets whether the user process may modify virtual page VPAGE
+   in PD to WRITABLE, if PD has a PTE for VPAGE. */
+void pagedir_set_writable(uint32_t *pd, const void *vpage, bool writable) {
+  uint32_t *pte = lookup_page(pd, vpage, false);
+  if (pte != NULL) {
+    if (writable)
+      *pte |= PTE_W;
+    else {
+      *pte &= ~(uint32_t)PTE_W;
+      invalidate_pagedir(pd);
+    }
+  }
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void pagedir_activate(uint32_t *pd) {
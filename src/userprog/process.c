@@ -21,6 +21,7 @@
 #include <string.h>
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
 static bool load(const char *cmdline, void (**eip)(void), void **esp);
 
 /* Starts a new thread running a user program loaded from
@@ -74,6 +75,7 @@ static void start_process(void *file_name_)
   /* Init vm table, mmap list*/
   init_vm_table(&current_thread->vm_table);
   list_init(&current_thread->mmap_list);
+  current_thread->swap_ra_window = SWAP_RA_INIT;
 
   /* Initialize interrupt frame and load executable. */
   memset(&if_, 0, sizeof if_);
@@ -100,6 +102,90 @@ static void start_process(void *file_name_)
   NOT_REACHED();
 }
 
+/* Data passed from process_fork() to start_fork(). */
+struct fork_args {
+  struct thread *parent; /* Process that called fork(). */
+  struct intr_frame if_; /* Its user context at the system call. */
+};
+
+/* Starts a new process that is a copy of the current one, which
+   made the system call whose frame is F, and that returns 0 from
+   the call.  Pages are shared copy-on-write, so nothing is read
+   from the executable.  Returns the new process's thread id, or
+   TID_ERROR if the process cannot be created. */
+tid_t process_fork(struct intr_frame *f) {
+  struct fork_args args;
+  struct thread *child_thread;
+  tid_t tid;
+
+  args.parent = thread_current();
+  args.if_ = *f;
+  tid = thread_create(thread_name(), PRI_DEFAULT, start_fork, &args);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  /* Wait for the child to copy the address space, which also
+     keeps ARGS alive until it is done with them. */
+  child_thread = get_child(tid);
+  sema_down(&child_thread->load_lock);
+  if (!child_thread->load_success)
+    return TID_ERROR;
+  return tid;
+}
+
+/* A thread function that copies the address space and open
+   files of the process that called fork() and starts running
+   the copy. */
+static void start_fork(void *args_) {
+  struct fork_args *args = args_;
+  struct thread *parent = args->parent;
+  struct thread *current_thread = thread_current();
+  struct intr_frame if_ = args->if_;
+  bool success = false;
+  int fd;
+
+  /* Init vm table, mmap list*/
+  init_vm_table(&current_thread->vm_table);
+  list_init(&current_thread->mmap_list);
+  current_thread->swap_ra_window = SWAP_RA_INIT;
+
+  current_thread->pagedir = pagedir_create();
+  if (current_thread->pagedir == NULL)
+    goto done;
+  process_activate();
+
+  /* Each open file is reopened at the same position, since files
+     cannot be shared between processes. */
+  current_thread->load_file = file_reopen(parent->load_file);
+  if (current_thread->load_file == NULL)
+    goto done;
+  file_deny_write(current_thread->load_file);
+  for (fd = 2; fd < MAX_FD; fd++) {
+    struct file *f = parent->fd_table[fd];
+
+    if (f == NULL)
+      continue;
+    current_thread->fd_table[fd] = file_reopen(f);
+    if (current_thread->fd_table[fd] == NULL)
+      goto done;
+    file_seek(current_thread->fd_table[fd], file_tell(f));
+  }
+  current_thread->next_fd = parent->next_fd;
+
+  success = fork_vm_table(parent);
+
+done:
+  current_thread->load_success = success;
+  sema_up(&current_thread->load_lock);
+  if (!success)
+    thread_exit();
+
+  /* fork() returns 0 in the child. */
+  if_.eax = 0;
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
+
 struct thread *get_child(tid_t child_tid) {
   struct thread *cur_thread = thread_current();
   struct list_elem *node = list_begin(&cur_thread->child_thread);
@@ -151,8 +237,6 @@ void process_exit(void) {
   pd = cur->pagedir;
   struct list_elem *node = list_begin(&cur->child_thread);
   struct thread *t;
-  if (cur->load_file != NULL)
-    file_close(cur->load_file);
   while (node != list_end(&cur->child_thread)) {
     // printf("reaping child,\n");
     t = list_entry(node, struct thread, child_thread_elem);
@@ -169,6 +253,10 @@ void process_exit(void) {
 
   palloc_free_page(cur->fd_table);
   destroy_table(&cur->vm_table);
+  /* Only close the executable once its pages are unmapped, since
+     shared pages are looked up by its inode. */
+  if (cur->load_file != NULL)
+    file_close(cur->load_file);
   if (pd != NULL) {
     //
     /* Correct ordering here is crucial.  We must set
@@ -581,6 +669,7 @@ static bool setup_stack(void **esp) {
       new->writable = true;
       kpage->entry = new;
       ASSERT(insert_vm_entry(&thread_current()->vm_table, new));
+      unpin_page(kpage->kaddr);
     }
 
     else
@@ -2,6 +2,7 @@
 #define USERPROG_PROCESS_H
 
 #include "filesys/file.h"
+#include "threads/interrupt.h"
 #include "threads/thread.h"
 
 #define MAX_FD 127
@@ -9,6 +10,7 @@
 #define STDIN 0
 
 tid_t process_execute(const char *file_name);
+tid_t process_fork(struct intr_frame *f);
 int process_wait(tid_t);
 void process_exit(void);
 void process_activate(void);
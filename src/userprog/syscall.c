@@ -1,4 +1,5 @@
 #include "userprog/syscall.h"
+#include "devices/block.h"
 #include "devices/shutdown.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -10,6 +11,7 @@
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "vm/frame.h"
 #include "vm/page.h"
 #include <stdio.h>
 #include <syscall-nr.h>
@@ -36,11 +38,9 @@ void close(int fd);
 mapid_t mmap(int fd, void *addr);
 void munmap(mapid_t mapid);
 
-struct semaphore file_write_lock;
-struct semaphore file_read_lock;
-struct semaphore file_lock;
+bool iostat(int dev, struct iostat *stats);
+
 struct lock mapid_lock;
-unsigned read_cnt;
 
 /**
  * Check fd is out of range
@@ -85,12 +85,22 @@ void check_valid_address(void *addr) {
   }
 }
 
+/* Copies the null-terminated user string USTR into a new page,
+   so that the file system never reads user memory, which could
+   fault and re-enter the file system while it holds its locks.
+   Terminates the process if there is no memory for the copy.
+   The caller frees the page with palloc_free_page(). */
+static char *copy_in_string(const char *ustr) {
+  char *kstr = palloc_get_page(0);
+
+  if (kstr == NULL)
+    exit(-1);
+  strlcpy(kstr, ustr, PGSIZE);
+  return kstr;
+}
+
 void syscall_init(void) {
-  sema_init(&file_write_lock, 1);
-  sema_init(&file_read_lock, 1);
-  sema_init(&file_lock, 1);
   lock_init(&mapid_lock);
-  read_cnt = 0;
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -147,6 +157,13 @@ static void syscall_handler(struct intr_frame *f UNUSED) {
     check_valid_address(((uint32_t *)f->esp + 1));
     f->eax = exec(*((uint32_t *)f->esp + 1));
     break;
+  case SYS_FORK:
+    /**
+     * esp[0] = system call number
+     */
+
+    f->eax = process_fork(f);
+    break;
   case SYS_READ:
     /**
      * esp[0] = system call number
@@ -214,6 +231,12 @@ static void syscall_handler(struct intr_frame *f UNUSED) {
     check_valid_address(((uint32_t *)f->esp + 1));
     munmap((mapid_t) * ((uint32_t *)f->esp + 1));
     break;
+
+  case SYS_IOSTAT:
+    check_valid_address(((uint32_t *)f->esp + 2));
+    f->eax = iostat((int)*((uint32_t *)f->esp + 1),
+                    (struct iostat *)*((uint32_t *)f->esp + 2));
+    break;
   case SYS_FIBO:
     /**
      * esp[0] = system call number
@@ -253,9 +276,7 @@ void exit(int status) {
   for (struct list_elem *e = list_begin(&current_thread->mmap_list);
        e != list_end(&current_thread->mmap_list);) {
     struct mmap_entry *entry = list_entry(e, struct mmap_entry, elem);
-    sema_down(&file_lock);
     remove_mmap_entry(entry);
-    sema_up(&file_lock);
     e = list_next(e);
     free(entry);
   }
@@ -267,7 +288,6 @@ tid_t exec(const char *cmd_line) {
   // check cmd_line buffer is point wrong address
   if (!check_vm_address(cmd_line, false))
     return -1;
-  sema_down(&file_lock);
   tid_t tid = process_execute(cmd_line);
   struct thread *child_thread = get_child(tid);
   bool success;
@@ -275,7 +295,6 @@ tid_t exec(const char *cmd_line) {
   // wait child process load file
   sema_down(&child_thread->load_lock);
   success = child_thread->load_success;
-  sema_up(&file_lock);
   if (!success) {
     return -1;
   }
@@ -302,9 +321,10 @@ int write(int fd, const void *buffer, unsigned size) {
   if (f == NULL)
     exit(-1);
 
-  sema_down(&file_write_lock);
+  if (!pin_user_buffer(buffer, size, false))
+    exit(-1);
   writen_bytes = file_write(f, buffer, size);
-  sema_up(&file_write_lock);
+  unpin_user_buffer(buffer, size);
 
   return writen_bytes;
 }
@@ -326,19 +346,10 @@ int read(int fd, void *buffer, unsigned size) {
   if (f == NULL)
     exit(-1);
 
-  sema_down(&file_read_lock);
-  read_cnt++;
-  if (read_cnt)
-    sema_down(&file_write_lock);
-  sema_up(&file_read_lock);
-
+  if (!pin_user_buffer(buffer, size, true))
+    exit(-1);
   readn_bytes = file_read(f, buffer, size);
-
-  sema_down(&file_read_lock);
-  read_cnt--;
-  if (read_cnt == 0)
-    sema_up(&file_write_lock);
-  sema_up(&file_read_lock);
+  unpin_user_buffer(buffer, size);
 
   return readn_bytes;
 }
@@ -370,9 +381,9 @@ int open(const char *file_name) {
   if (!check_vm_address(file_name, false)) {
     exit(-1);
   }
-  sema_down(&file_lock);
-  struct file *f = filesys_open(file_name);
-  sema_up(&file_lock);
+  char *name = copy_in_string(file_name);
+  struct file *f = filesys_open(name);
+  palloc_free_page(name);
   if (f == NULL) {
     // PANIC("FILE NOT FOUND");
     return -1;
@@ -392,9 +403,9 @@ bool create(const char *file_name, unsigned initial_size) {
   if (!check_vm_address(file_name, false)) {
     exit(-1);
   }
-  sema_down(&file_lock);
-  bool success = filesys_create(file_name, initial_size);
-  sema_up(&file_lock);
+  char *name = copy_in_string(file_name);
+  bool success = filesys_create(name, initial_size);
+  palloc_free_page(name);
   return success;
 }
 
@@ -402,9 +413,9 @@ bool remove(const char *file_name) {
   if (!check_vm_address(file_name, false)) {
     exit(-1);
   }
-  sema_down(&file_lock);
-  bool success = filesys_remove(file_name);
-  sema_up(&file_lock);
+  char *name = copy_in_string(file_name);
+  bool success = filesys_remove(name);
+  palloc_free_page(name);
   return success;
 }
 
@@ -481,10 +492,23 @@ void munmap(mapid_t mapid) {
       break;
   }
   if (entry != NULL) {
-    sema_down(&file_lock);
     remove_mmap_entry(entry);
-    sema_up(&file_lock);
     list_remove(&entry->elem);
     free(entry);
   }
 }
+
+/* Copies the I/O statistics of block device DEV, counting from 0
+   in order of registration, to STATS.  Returns false if there is
+   no such device. */
+bool iostat(int dev, struct iostat *stats) {
+  struct iostat kstats;
+
+  if (!check_valid_buffer(stats, sizeof *stats, true) ||
+      !check_vm_address((char *)stats + sizeof *stats - 1, true))
+    exit(-1);
+  if (dev < 0 || !block_get_stats(dev, &kstats))
+    return false;
+  memcpy(stats, &kstats, sizeof *stats);
+  return true;
+}
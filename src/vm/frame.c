@@ -1,36 +1,665 @@
 #include "frame.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include <debug.h>
+#include <hash.h>
 #include <stdlib.h>
-struct page *alloc_page(enum palloc_flags flags) {
-  void *kaddr = palloc_get_page(flags);
-  struct page *new_page;
-  while (kaddr == NULL) {
-    // TODO SWAP OUT
-    kaddr = swap_out();
-    free_page(kaddr);
-    kaddr = palloc_get_page(flags);
+#include <string.h>
+
+/* The frame table has one entry per page in the user pool,
+   indexed by the page's position in the pool, so that finding
+   the frame for a kernel address takes constant time.  A frame
+   is in use if its kaddr is non-null.
+
+   Victims are chosen by a clock that sweeps every frame, no
+   matter which process owns it.  A pinned frame is never
+   chosen: alloc_page() returns its frame pinned until the page
+   is installed, and system calls pin user buffers while the
+   kernel accesses them.
+
+   Read-only pages of executables are shared: every process that
+   maps the same page of the same file maps the same frame, found
+   through the shared_pages table.  Each shared page keeps a list
+   of the vm_entries that map it, so that evicting it can unmap
+   it everywhere.
+
+   fork() shares the parent's other pages with the child
+   copy-on-write through the same mechanism: each becomes an
+   anonymous shared page, mapped read-only in both processes,
+   and a write to it gives the writer a private copy.  Unlike a
+   page of an executable, an anonymous shared page goes to swap
+   when it is evicted. */
+static struct page *frames;
+static size_t frame_cnt;
+
+/* A page shared by several processes: either a read-only page
+   of an executable, or an anonymous page shared copy-on-write
+   since a fork(). */
+struct shared_page {
+  struct hash_elem elem; /* Element in shared_pages, if file-backed. */
+  struct inode *inode;   /* File that backs the page, or null. */
+  off_t offset;          /* Offset of the page in the file. */
+  size_t swap_index;     /* Swap slot of an anonymous page not in memory. */
+  struct page *frame;    /* Frame holding the page, or null. */
+  bool busy;             /* Is the page being read in or written out? */
+  struct list mappings;  /* vm_entries that map the page. */
+};
+
+/* File-backed shared pages, keyed by inode and offset. */
+static struct hash shared_pages;
+
+/* Protects the frame table, clock_hand, the evicting member of
+   every vm_entry, and the shared pages. */
+static struct lock frame_lock;
+
+/* Signaled when a frame's pin_cnt drops to 0. */
+static struct condition frame_unpinned;
+
+/* Broadcast when a page finishes being evicted. */
+static struct condition eviction_done;
+
+/* Broadcast when a shared page is no longer busy. */
+static struct condition shared_idle;
+
+/* Next frame examined by select_victim(). */
+static size_t clock_hand;
+
+static hash_hash_func shared_page_hash;
+static hash_less_func shared_page_less;
+
+void frame_init(void) {
+  frame_cnt = palloc_user_page_cnt();
+  frames = calloc(frame_cnt, sizeof *frames);
+  if (frames == NULL && frame_cnt > 0)
+    PANIC("Failed to allocate frame table.");
+  lock_init(&frame_lock);
+  cond_init(&frame_unpinned);
+  cond_init(&eviction_done);
+  cond_init(&shared_idle);
+  hash_init(&shared_pages, shared_page_hash, shared_page_less, NULL);
+  clock_hand = 0;
+}
+
+/* Returns a hash value for shared page E. */
+static unsigned shared_page_hash(const struct hash_elem *e, void *aux UNUSED) {
+  const struct shared_page *sp = hash_entry(e, struct shared_page, elem);
+  return hash_bytes(&sp->inode, sizeof sp->inode) ^ hash_int(sp->offset);
+}
+
+/* Returns true if shared page A precedes shared page B. */
+static bool shared_page_less(const struct hash_elem *a_,
+                             const struct hash_elem *b_, void *aux UNUSED) {
+  const struct shared_page *a = hash_entry(a_, struct shared_page, elem);
+  const struct shared_page *b = hash_entry(b_, struct shared_page, elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  return a->offset < b->offset;
+}
+
+/* Returns the frame that holds KADDR. */
+static struct page *frame_lookup(void *kaddr) {
+  return &frames[palloc_user_page_idx(kaddr)];
+}
+
+/* Returns true if the page in frame P has been accessed through
+   any of its mappings since the last call, and clears the
+   accessed bits. */
+static bool test_and_clear_accessed(struct page *p) {
+  struct list_elem *e;
+  bool accessed = false;
+
+  if (p->shared == NULL) {
+    accessed = pagedir_is_accessed(p->entry->t->pagedir, p->entry->vaddr);
+    pagedir_set_accessed(p->entry->t->pagedir, p->entry->vaddr, false);
+    return accessed;
   }
-  ASSERT(kaddr);
-  new_page = malloc(sizeof(struct page));
-  new_page->kaddr = kaddr;
-  list_push_back(&lru_pages, &new_page->elem);
+  for (e = list_begin(&p->shared->mappings);
+       e != list_end(&p->shared->mappings); e = list_next(e)) {
+    struct vm_entry *entry = list_entry(e, struct vm_entry, share_elem);
+    if (pagedir_is_accessed(entry->t->pagedir, entry->vaddr)) {
+      accessed = true;
+      pagedir_set_accessed(entry->t->pagedir, entry->vaddr, false);
+    }
+  }
+  return accessed;
+}
 
-  ASSERT(new_page != NULL);
+/* Chooses a frame to evict with the clock algorithm, giving
+   pages that were accessed since the hand last passed them a
+   second chance.  If every frame is pinned, waits for one to be
+   unpinned if WAIT is true, and otherwise returns a null
+   pointer.  Must be called with frame_lock held. */
+static struct page *select_victim(bool wait) {
+  for (;;) {
+    size_t i;
 
-  return new_page;
+    for (i = 0; i < 2 * frame_cnt; i++) {
+      struct page *p = &frames[clock_hand];
+      clock_hand = (clock_hand + 1) % frame_cnt;
+
+      if (p->kaddr == NULL || p->pin_cnt > 0 ||
+          (p->entry == NULL && p->shared == NULL))
+        continue;
+      if (!test_and_clear_accessed(p))
+        return p;
+    }
+    if (!wait)
+      return NULL;
+    cond_wait(&frame_unpinned, &frame_lock);
+  }
+}
+
+/* Returns frame P, which must not be pinned by anyone else, to
+   the user pool.  Must be called with frame_lock held. */
+static void release_frame(struct page *p) {
+  palloc_free_page(p->kaddr);
+  p->kaddr = NULL;
+  p->entry = NULL;
+  p->shared = NULL;
+  if (p->pin_cnt > 0) {
+    p->pin_cnt = 0;
+    cond_signal(&frame_unpinned, &frame_lock);
+  }
 }
-void free_page(void *kaddr) {
 
+/* Unmaps shared page SP from every process that maps it.  Must
+   be called with frame_lock held. */
+static void unmap_everywhere(struct shared_page *sp) {
   struct list_elem *e;
-  struct page *p = NULL;
-  for (e = list_begin(&lru_pages); e != list_end(&lru_pages);
+
+  for (e = list_begin(&sp->mappings); e != list_end(&sp->mappings);
        e = list_next(e)) {
-    p = list_entry(e, struct page, elem);
-    if (p->kaddr == kaddr)
+    struct vm_entry *entry = list_entry(e, struct vm_entry, share_elem);
+    pagedir_clear_page(entry->t->pagedir, entry->vaddr);
+    entry->is_loaded = false;
+  }
+}
+
+/* Evicts up to SWAP_OUT_MAX pages to make room in the user
+   pool, so that their swap writes go out as one batch and later
+   allocations find free frames.  The victims' mappings are
+   removed before their contents are written out, so their owners
+   cannot change them in the meantime; a fault on one of them
+   waits until the eviction is done.  Shared pages of executables
+   are clean and are dropped on the spot.  Must be called with
+   frame_lock held, which is released during the writes. */
+static void evict_pages(void) {
+  struct page *victims[SWAP_OUT_MAX];     /* Private pages. */
+  struct page *cow_victims[SWAP_OUT_MAX]; /* Anonymous shared pages. */
+  struct block_request cow_reqs[SWAP_OUT_MAX];
+  size_t cnt = 0;
+  size_t cow_cnt = 0;
+  size_t dropped_cnt = 0;
+  size_t i;
+
+  do {
+    struct page *victim = select_victim(cnt + cow_cnt + dropped_cnt == 0);
+    struct shared_page *sp;
+    struct vm_entry *entry;
+
+    if (victim == NULL)
       break;
+    sp = victim->shared;
+    if (sp != NULL) {
+      unmap_everywhere(sp);
+      if (sp->inode != NULL) {
+        sp->frame = NULL;
+        release_frame(victim);
+        dropped_cnt++;
+      } else {
+        victim->pin_cnt++;
+        sp->busy = true;
+        cow_victims[cow_cnt++] = victim;
+      }
+      continue;
+    }
+    entry = victim->entry;
+    victim->pin_cnt++;
+    entry->evicting = true;
+    pagedir_clear_page(entry->t->pagedir, entry->vaddr);
+    victims[cnt++] = victim;
+  } while (cnt + cow_cnt + dropped_cnt < SWAP_OUT_MAX);
+  if (cnt + cow_cnt == 0)
+    return;
+  lock_release(&frame_lock);
+
+  /* Start the shared pages' writes first, so that they are in
+     flight together with everything swap_out() writes. */
+  for (i = 0; i < cow_cnt; i++)
+    cow_victims[i]->shared->swap_index =
+        swap_write_page(cow_victims[i]->kaddr, &cow_reqs[i]);
+  if (cnt > 0)
+    swap_out(victims, cnt);
+  for (i = 0; i < cow_cnt; i++)
+    block_wait(&cow_reqs[i]);
+
+  lock_acquire(&frame_lock);
+  for (i = 0; i < cnt; i++) {
+    struct page *victim = victims[i];
+
+    victim->entry->is_loaded = false;
+    victim->entry->evicting = false;
+    victim->pin_cnt = 0;
+    release_frame(victim);
+  }
+  for (i = 0; i < cow_cnt; i++) {
+    struct page *victim = cow_victims[i];
+
+    victim->shared->frame = NULL;
+    victim->shared->busy = false;
+    victim->pin_cnt = 0;
+    release_frame(victim);
+  }
+  cond_broadcast(&eviction_done, &frame_lock);
+  if (cow_cnt > 0)
+    cond_broadcast(&shared_idle, &frame_lock);
+}
+
+/* Takes ownership of the free user pool page KADDR as a pinned
+   frame.  Must be called with frame_lock held. */
+static struct page *claim_frame(void *kaddr) {
+  struct page *p = frame_lookup(kaddr);
+
+  p->kaddr = kaddr;
+  p->entry = NULL;
+  p->shared = NULL;
+  p->pin_cnt = 1;
+  return p;
+}
+
+/* Allocates a frame from the user pool, evicting pages if
+   necessary.  The frame is returned pinned: the caller sets its
+   entry, installs it, and then calls unpin_page(). */
+struct page *alloc_page(enum palloc_flags flags) {
+  struct page *new_page;
+  void *kaddr;
+
+  ASSERT(flags & PAL_USER);
+
+  lock_acquire(&frame_lock);
+  while ((kaddr = palloc_get_page(flags)) == NULL)
+    evict_pages();
+  new_page = claim_frame(kaddr);
+  lock_release(&frame_lock);
+
+  return new_page;
+}
+
+/* Like alloc_page(), but returns a null pointer instead of
+   evicting anything if the user pool is exhausted.  For
+   speculative reads, which are not worth an eviction. */
+struct page *alloc_free_page(enum palloc_flags flags) {
+  struct page *new_page = NULL;
+  void *kaddr;
+
+  ASSERT(flags & PAL_USER);
+
+  lock_acquire(&frame_lock);
+  kaddr = palloc_get_page(flags);
+  if (kaddr != NULL)
+    new_page = claim_frame(kaddr);
+  lock_release(&frame_lock);
+
+  return new_page;
+}
+
+/* Frees the frame holding KADDR.  The caller must make sure it
+   cannot be evicted meanwhile, by keeping it pinned or by having
+   obtained it from frame_pin_entry(). */
+void free_page(void *kaddr) {
+  struct page *p;
+
+  lock_acquire(&frame_lock);
+  p = frame_lookup(kaddr);
+  ASSERT(p->kaddr == kaddr);
+  ASSERT(p->shared == NULL);
+  release_frame(p);
+  lock_release(&frame_lock);
+}
+
+/* Unpins the frame holding KADDR. */
+void unpin_page(void *kaddr) {
+  struct page *p;
+
+  lock_acquire(&frame_lock);
+  p = frame_lookup(kaddr);
+  ASSERT(p->pin_cnt > 0);
+  if (--p->pin_cnt == 0)
+    cond_signal(&frame_unpinned, &frame_lock);
+  lock_release(&frame_lock);
+}
+
+/* Waits for any eviction of ENTRY's page in progress to finish.
+   Then, if the page is in memory, pins its frame and returns its
+   kernel address; otherwise, returns a null pointer. */
+void *frame_pin_entry(struct vm_entry *entry) {
+  void *kaddr;
+
+  lock_acquire(&frame_lock);
+  while (entry->evicting)
+    cond_wait(&eviction_done, &frame_lock);
+  kaddr = pagedir_get_page(entry->t->pagedir, entry->vaddr);
+  if (kaddr != NULL)
+    frame_lookup(kaddr)->pin_cnt++;
+  lock_release(&frame_lock);
+
+  return kaddr;
+}
+
+/* Returns a new shared page for the page at OFFSET in INODE, or
+   for an anonymous page if INODE is null, with no frame and no
+   mappings, or a null pointer if out of memory. */
+static struct shared_page *create_shared_page(struct inode *inode,
+                                              off_t offset) {
+  struct shared_page *sp = malloc(sizeof *sp);
+
+  if (sp == NULL)
+    return NULL;
+  sp->inode = inode;
+  sp->offset = offset;
+  sp->swap_index = 0;
+  sp->frame = NULL;
+  sp->busy = false;
+  list_init(&sp->mappings);
+  return sp;
+}
+
+/* Brings shared page SP into memory, reading it from ENTRY's
+   file or from swap if it is not there, and returns its frame
+   pinned, or a null pointer if the page cannot be read.  Must be
+   called with frame_lock held, which is released during the
+   read. */
+static struct page *pin_shared_page(struct shared_page *sp,
+                                    struct vm_entry *entry) {
+  struct page *p;
+  bool success = true;
+
+  while (sp->busy)
+    cond_wait(&shared_idle, &frame_lock);
+  if (sp->frame != NULL) {
+    p = sp->frame;
+    p->pin_cnt++;
+    return p;
+  }
+
+  sp->busy = true;
+  lock_release(&frame_lock);
+
+  p = alloc_page(PAL_USER);
+  if (sp->inode != NULL) {
+    success = file_read_at(entry->file, p->kaddr, entry->read_bytes,
+                           entry->offset) == (int)entry->read_bytes;
+    memset((uint8_t *)p->kaddr + entry->read_bytes, 0, entry->zero_bytes);
+  } else
+    swap_read_page(sp->swap_index, p->kaddr);
+
+  lock_acquire(&frame_lock);
+  sp->busy = false;
+  cond_broadcast(&shared_idle, &frame_lock);
+  if (!success) {
+    release_frame(p);
+    return NULL;
+  }
+  sp->frame = p;
+  p->shared = sp;
+  return p;
+}
+
+/* Removes ENTRY from the mappings of its shared page, and frees
+   the page if no process maps it any more.  Must be called with
+   frame_lock held. */
+static void drop_mapping(struct vm_entry *entry) {
+  struct shared_page *sp = entry->shared;
+
+  pagedir_clear_page(entry->t->pagedir, entry->vaddr);
+  list_remove(&entry->share_elem);
+  entry->shared = NULL;
+  entry->cow = false;
+  entry->is_loaded = false;
+  if (!list_empty(&sp->mappings))
+    return;
+
+  if (sp->frame != NULL) {
+    ASSERT(sp->frame->pin_cnt == 0);
+    release_frame(sp->frame);
+  } else if (sp->inode == NULL)
+    swap_free(sp->swap_index);
+  if (sp->inode != NULL)
+    hash_delete(&shared_pages, &sp->elem);
+  free(sp);
+}
+
+/* Maps ENTRY to the frame of the page it shares with other
+   processes, reading the page in if no process has it in memory.
+   ENTRY is either a read-only page of an executable, which is
+   shared with every process that maps the same page of the same
+   file, or a page shared copy-on-write since a fork(), which is
+   mapped read-only until it is written.  Returns true if
+   successful, false if the page cannot be read. */
+bool map_shared_page(struct vm_entry *entry) {
+  struct shared_page *sp;
+  struct page *p;
+  bool success;
+
+  ASSERT(entry->cow || (entry->type == VM_BIN && !entry->writable));
+
+  lock_acquire(&frame_lock);
+  sp = entry->shared;
+  if (sp == NULL) {
+    struct shared_page key;
+    struct hash_elem *e;
+
+    key.inode = file_get_inode(entry->file);
+    key.offset = entry->offset;
+    e = hash_find(&shared_pages, &key.elem);
+    if (e != NULL)
+      sp = hash_entry(e, struct shared_page, elem);
+    else {
+      sp = create_shared_page(key.inode, key.offset);
+      if (sp == NULL) {
+        lock_release(&frame_lock);
+        return false;
+      }
+      hash_insert(&shared_pages, &sp->elem);
+    }
+    list_push_back(&sp->mappings, &entry->share_elem);
+    entry->shared = sp;
+  }
+
+  p = pin_shared_page(sp, entry);
+  if (p == NULL) {
+    lock_release(&frame_lock);
+    return false;
+  }
+  success = install_page(entry->vaddr, p->kaddr, false);
+  if (success)
+    entry->is_loaded = true;
+  if (--p->pin_cnt == 0)
+    cond_signal(&frame_unpinned, &frame_lock);
+  lock_release(&frame_lock);
+  return success;
+}
+
+/* Unmaps ENTRY from its shared page when ENTRY is destroyed.  The
+   last process to unmap a shared page frees it. */
+void unmap_shared_page(struct vm_entry *entry) {
+  lock_acquire(&frame_lock);
+  while (entry->shared->busy)
+    cond_wait(&shared_idle, &frame_lock);
+  drop_mapping(entry);
+  lock_release(&frame_lock);
+}
+
+/* Gives CHILD, the copy of the parent's vm_entry PARENT that
+   fork() made in the current process, the same page.  A page in
+   memory or in swap is shared copy-on-write: it becomes an
+   anonymous shared page, mapped read-only in both processes.  A
+   page not loaded yet is left for CHILD to load from its file,
+   the way PARENT would.  Returns false if out of memory. */
+bool fork_page(struct vm_entry *parent, struct vm_entry *child) {
+  struct shared_page *sp = NULL;
+  bool success = true;
+
+  lock_acquire(&frame_lock);
+  while (parent->evicting)
+    cond_wait(&eviction_done, &frame_lock);
+
+  if (parent->cow) {
+    sp = parent->shared;
+    while (sp->busy)
+      cond_wait(&shared_idle, &frame_lock);
+  } else if (parent->shared == NULL) {
+    void *kaddr = pagedir_get_page(parent->t->pagedir, parent->vaddr);
+
+    if (kaddr != NULL || parent->type == VM_ANON) {
+      sp = create_shared_page(NULL, 0);
+      if (sp == NULL) {
+        lock_release(&frame_lock);
+        return false;
+      }
+      if (kaddr != NULL) {
+        sp->frame = frame_lookup(kaddr);
+        sp->frame->entry = NULL;
+        sp->frame->shared = sp;
+        pagedir_set_writable(parent->t->pagedir, parent->vaddr, false);
+      } else
+        sp->swap_index = parent->swap_index;
+      parent->type = VM_ANON;
+      parent->shared = sp;
+      parent->cow = true;
+      list_push_back(&sp->mappings, &parent->share_elem);
+    }
   }
-  ASSERT(p)
-  palloc_free_page(kaddr);
-  list_remove(&p->elem);
-  free(p);
-}
\ No newline at end of file
+
+  if (sp != NULL) {
+    child->type = VM_ANON;
+    child->shared = sp;
+    child->cow = true;
+    list_push_back(&sp->mappings, &child->share_elem);
+    if (sp->frame != NULL) {
+      success = pagedir_set_page(child->t->pagedir, child->vaddr,
+                                 sp->frame->kaddr, false);
+      child->is_loaded = success;
+    }
+  } else {
+    /* Set only here, so that a CHILD left behind by a failure
+       above does not free PARENT's swap slot when destroyed. */
+    child->type = parent->type;
+    child->swap_index = parent->swap_index;
+  }
+  lock_release(&frame_lock);
+  return success;
+}
+
+/* Gives ENTRY, which shares its page copy-on-write, a private
+   copy of the page that it can write.  If no other process
+   shares the page any more, ENTRY simply takes it over, without
+   copying.  Returns false if the page cannot be mapped. */
+bool unshare_page(struct vm_entry *entry) {
+  struct shared_page *sp = entry->shared;
+  uint32_t *pd = entry->t->pagedir;
+  struct page *old, *new;
+  bool success = true;
+
+  ASSERT(entry->cow);
+
+  lock_acquire(&frame_lock);
+  while (sp->busy)
+    cond_wait(&shared_idle, &frame_lock);
+  if (list_size(&sp->mappings) == 1) {
+    old = sp->frame;
+    list_remove(&entry->share_elem);
+    entry->shared = NULL;
+    entry->cow = false;
+    if (old == NULL) {
+      /* The page is in swap, and is now ENTRY's alone. */
+      entry->swap_index = sp->swap_index;
+      entry->is_loaded = false;
+    } else {
+      old->shared = NULL;
+      old->entry = entry;
+      if (pagedir_get_page(pd, entry->vaddr) != NULL)
+        pagedir_set_writable(pd, entry->vaddr, true);
+      else
+        success = pagedir_set_page(pd, entry->vaddr, old->kaddr, true);
+      entry->is_loaded = success;
+    }
+    free(sp);
+    lock_release(&frame_lock);
+    return success;
+  }
+
+  old = pin_shared_page(sp, entry);
+  lock_release(&frame_lock);
+
+  new = alloc_page(PAL_USER);
+  memcpy(new->kaddr, old->kaddr, PGSIZE);
+
+  lock_acquire(&frame_lock);
+  if (--old->pin_cnt == 0)
+    cond_signal(&frame_unpinned, &frame_lock);
+  drop_mapping(entry);
+  success = pagedir_set_page(pd, entry->vaddr, new->kaddr, true);
+  if (success) {
+    entry->is_loaded = true;
+    new->entry = entry;
+    if (--new->pin_cnt == 0)
+      cond_signal(&frame_unpinned, &frame_lock);
+  } else
+    release_frame(new);
+  lock_release(&frame_lock);
+  return success;
+}
+
+/* Brings each page of the SIZE bytes of user memory at BUFFER
+   into memory and pins it, so that the kernel can access the
+   buffer without faulting, and thus without evicting pages
+   while it holds file system locks.  If WRITE is true, pages
+   shared copy-on-write are copied first, since the kernel is
+   about to write them.  Returns true if successful, false if
+   part of the buffer is not mapped, in which case nothing is left
+   pinned. */
+bool pin_user_buffer(const void *buffer, size_t size, bool write) {
+  struct thread *t = thread_current();
+  const uint8_t *upage;
+
+  if (size == 0)
+    return true;
+  for (upage = pg_round_down(buffer); upage < (const uint8_t *)buffer + size;
+       upage += PGSIZE) {
+    struct vm_entry *entry = find_vm_entry(&t->vm_table, (void *)upage);
+
+    if (entry == NULL) {
+      if (upage > (const uint8_t *)pg_round_down(buffer))
+        unpin_user_buffer(buffer, upage - (const uint8_t *)buffer);
+      return false;
+    }
+    if (write && entry->cow && !unshare_page(entry)) {
+      if (upage > (const uint8_t *)pg_round_down(buffer))
+        unpin_user_buffer(buffer, upage - (const uint8_t *)buffer);
+      return false;
+    }
+    while (frame_pin_entry(entry) == NULL)
+      /* Touching the page faults it in. */
+      (void)*(volatile const uint8_t *)upage;
+  }
+  return true;
+}
+
+/* Unpins the pages pinned by pin_user_buffer(BUFFER, SIZE). */
+void unpin_user_buffer(const void *buffer, size_t size) {
+  struct thread *t = thread_current();
+  const uint8_t *upage;
+
+  if (size == 0)
+    return;
+  for (upage = pg_round_down(buffer); upage < (const uint8_t *)buffer + size;
+       upage += PGSIZE)
+    unpin_page(pagedir_get_page(t->pagedir, upage));
+}
@@ -1,4 +1,18 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
 #include "swap.h"
 #include "threads/palloc.h"
+void frame_init(void);
 struct page *alloc_page(enum palloc_flags flags);
+struct page *alloc_free_page(enum palloc_flags flags);
 void free_page(void *kaddr);
+void unpin_page(void *kaddr);
+void *frame_pin_entry(struct vm_entry *entry);
+bool map_shared_page(struct vm_entry *entry);
+void unmap_shared_page(struct vm_entry *entry);
+bool fork_page(struct vm_entry *parent, struct vm_entry *child);
+bool unshare_page(struct vm_entry *entry);
+bool pin_user_buffer(const void *buffer, size_t size, bool write);
+void unpin_user_buffer(const void *buffer, size_t size);
+
+#endif
@@ -2,10 +2,16 @@
 #include "filesys/file.h"
 #include "frame.h"
 #include "string.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
+
+/* Maximum number of pages loaded by one load_file_page(). */
+#define FAULT_AROUND_MAX 8
 static unsigned hash_func(const struct hash_elem *e, void *aux UNUSED) {
   const struct vm_entry *p = hash_entry(e, struct vm_entry, elem);
   return hash_int(p->vaddr);
@@ -21,11 +27,18 @@ static bool hash_less(const struct hash_elem *a, const struct hash_elem *b,
 static void hash_free_func(struct hash_elem *e, void *aux UNUSED) {
 
   struct vm_entry *p = hash_entry(e, struct vm_entry, elem);
-  void *kpage = pagedir_get_page(p->t->pagedir, p->vaddr);
-  if (p->is_loaded) {
-    free_page(kpage);
-    pagedir_clear_page(p->t->pagedir, p->vaddr);
+  void *kpage;
+  if (p->shared != NULL) {
+    unmap_shared_page(p);
+    free(p);
+    return;
   }
+  kpage = frame_pin_entry(p);
+  if (kpage != NULL) {
+    pagedir_clear_page(p->t->pagedir, p->vaddr);
+    free_page(kpage);
+  } else if (p->type == VM_ANON)
+    swap_free(p->swap_index);
   free(p);
 }
 
@@ -72,6 +85,109 @@ void destroy_table(struct hash *table) {
   hash_destroy(table, NULL);
 }
 
+/* Copies the address space of PARENT, which is waiting in
+   fork(), into the current process's vm_table, sharing pages
+   copy-on-write where it can.  Memory mappings are not
+   inherited.  Returns false if out of memory. */
+bool fork_vm_table(struct thread *parent) {
+  struct thread *t = thread_current();
+  struct hash_iterator i;
+
+  hash_first(&i, &parent->vm_table);
+  while (hash_next(&i)) {
+    struct vm_entry *p = hash_entry(hash_cur(&i), struct vm_entry, elem);
+    struct vm_entry *new;
+
+    if (p->type == VM_FILE)
+      continue;
+    new = (struct vm_entry *)malloc(sizeof(struct vm_entry));
+    if (new == NULL)
+      return false;
+    memset(new, 0, sizeof(struct vm_entry));
+    new->vaddr = p->vaddr;
+    new->writable = p->writable;
+    new->file = p->file == parent->load_file ? t->load_file : p->file;
+    new->offset = p->offset;
+    new->read_bytes = p->read_bytes;
+    new->zero_bytes = p->zero_bytes;
+    ASSERT(insert_vm_entry(&t->vm_table, new));
+    if (!fork_page(p, new))
+      return false;
+  }
+  return true;
+}
+
+/* Loads ENTRY's page, which is backed by a file, into KPAGE, a
+   pinned frame.  Also faults around it: the virtual pages that
+   follow ENTRY's, as long as they are backed by the next pages of
+   the same file and not yet loaded, are read into free frames
+   and mapped, so that sequential accesses take fewer faults.
+   Each page is read straight into its frame, in file order, so
+   the inode's read-ahead sees one sequential run.  Returns false
+   if ENTRY's page cannot be read. */
+bool load_file_page(struct vm_entry *entry, struct page *kpage) {
+  struct thread *t = thread_current();
+  struct vm_entry *entries[FAULT_AROUND_MAX];
+  struct page *pages[FAULT_AROUND_MAX];
+  size_t cnt = 0;
+  size_t read_cnt;
+  size_t i;
+
+  entries[cnt] = entry;
+  pages[cnt++] = kpage;
+  while (cnt < FAULT_AROUND_MAX && entries[cnt - 1]->read_bytes == PGSIZE) {
+    struct vm_entry *prev = entries[cnt - 1];
+    uint8_t *upage = (uint8_t *)prev->vaddr + PGSIZE;
+    struct vm_entry *e;
+    struct page *p;
+    void *kaddr;
+
+    if (!is_user_vaddr(upage))
+      break;
+    e = find_vm_entry(&t->vm_table, upage);
+    if (e == NULL)
+      break;
+    /* Eviction may change the type, so check it afterward. */
+    kaddr = frame_pin_entry(e);
+    if (kaddr != NULL) {
+      unpin_page(kaddr);
+      break;
+    }
+    if (e->type != entry->type || e->writable != entry->writable ||
+        e->file != entry->file ||
+        e->offset != prev->offset + PGSIZE || e->read_bytes == 0)
+      break;
+    p = alloc_free_page(PAL_USER);
+    if (p == NULL)
+      break;
+    entries[cnt] = e;
+    pages[cnt++] = p;
+  }
+
+  /* Read the pages until one comes up short. */
+  for (read_cnt = 0; read_cnt < cnt; read_cnt++) {
+    struct vm_entry *e = entries[read_cnt];
+    uint8_t *kaddr = pages[read_cnt]->kaddr;
+
+    if (file_read_at(e->file, kaddr, e->read_bytes, e->offset) !=
+        (int)e->read_bytes)
+      break;
+    memset(kaddr + e->read_bytes, 0, e->zero_bytes);
+  }
+
+  /* Map the pages faulted around, or give up on them. */
+  for (i = 1; i < cnt; i++) {
+    if (i < read_cnt && install_page(entries[i]->vaddr, pages[i]->kaddr,
+                                     entries[i]->writable)) {
+      entries[i]->is_loaded = true;
+      pages[i]->entry = entries[i];
+      unpin_page(pages[i]->kaddr);
+    } else
+      free_page(pages[i]->kaddr);
+  }
+  return read_cnt > 0;
+}
+
 bool load_mmap_entry(struct mmap_entry *entry, void *upage) {
   uint32_t read_bytes = file_length(entry->file);
   uint32_t zero_bytes = PGSIZE - (read_bytes % PGSIZE);
@@ -112,15 +228,22 @@ void remove_mmap_entry(struct mmap_entry *entry) {
   struct vm_entry *mmap_vm_entry = NULL;
   struct list_elem *e;
 
-  for (e = list_begin(&entry->vme_list); e != list_end(&entry->vme_list);
-       e = list_next(e)) {
+  for (e = list_begin(&entry->vme_list); e != list_end(&entry->vme_list);) {
     mmap_vm_entry = list_entry(e, struct vm_entry, mmap_elem);
-    void *kpage =
-        pagedir_get_page(mmap_vm_entry->t->pagedir, mmap_vm_entry->vaddr);
-    if (pagedir_is_dirty(mmap_vm_entry->t->pagedir, mmap_vm_entry->vaddr)) {
-      file_write_at(entry->file, kpage, PGSIZE, mmap_vm_entry->offset);
+    e = list_next(e);
+    /* Pinning keeps the page from being evicted while it is
+       written back and freed. */
+    void *kpage = frame_pin_entry(mmap_vm_entry);
+    if (kpage != NULL) {
+      if (pagedir_is_dirty(mmap_vm_entry->t->pagedir, mmap_vm_entry->vaddr)) {
+        file_write_at(entry->file, kpage, mmap_vm_entry->read_bytes,
+                      mmap_vm_entry->offset);
+      }
+      pagedir_clear_page(mmap_vm_entry->t->pagedir, mmap_vm_entry->vaddr);
+      free_page(kpage);
     }
     delete_vm_entry(&mmap_vm_entry->t->vm_table, mmap_vm_entry);
+    free(mmap_vm_entry);
   }
   file_close(entry->file);
 }
\ No newline at end of file
@@ -29,6 +29,11 @@ struct vm_entry {
   struct list_elem mmap_elem;
 
   size_t swap_index;
+  bool evicting; /* Being written out by evict_pages()? */
+
+  struct shared_page *shared;  /* Shared page mapped, or null. */
+  bool cow;                    /* Shared copy-on-write since fork()? */
+  struct list_elem share_elem; /* Element in shared page's mappings. */
 };
 
 struct mmap_entry {
@@ -40,18 +45,19 @@ struct mmap_entry {
 
 struct page {
   struct vm_entry *entry;
-  struct list_elem elem;
   void *kaddr;
+  int pin_cnt;                /* Never evicted while nonzero. */
+  struct shared_page *shared; /* Shared page held instead of ENTRY's. */
 };
 
-struct list lru_pages;
-
 void init_vm_table(struct hash *table);
 bool insert_vm_entry(struct hash *table, struct vm_entry *entry);
 bool delete_vm_entry(struct hash *table, struct vm_entry *entry);
 struct vm_entry *find_vm_entry(struct hash *table, void *addr);
 void destroy_table(struct hash *table);
+bool fork_vm_table(struct thread *parent);
 
+bool load_file_page(struct vm_entry *entry, struct page *kpage);
 bool load_mmap_entry(struct mmap_entry *entry, void *upage);
 void remove_mmap_entry(struct mmap_entry *entry);
 
@@ -2,86 +2,93 @@
 #include "bitmap.h"
 #include "devices/block.h"
 #include "filesys/file.h"
+#include "frame.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include <debug.h>
 #include <list.h>
+#include <stdio.h>
 #define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 static struct block *swap_block;
 static struct bitmap *swap_bitmap;
 static struct lock swap_lock;
 
-struct page *select_victim(void);
-size_t find_free_swap_slot(void);
-size_t write_swap_page(void *kaddr);
+/* Slot after the last run handed out by find_free_swap_slots(),
+   where the next search starts, so that successive batches of
+   page-outs land one after another on disk. */
+static size_t next_slot;
 
-struct list_elem *clock_pointer = NULL;
+/* Read-around statistics. */
+static unsigned long long ra_page_cnt; /* Pages read around. */
+static unsigned long long ra_hit_cnt;  /* Of those, pages used. */
 
-struct page *select_victim() {
-  struct thread *t = thread_current();
-  if (clock_pointer == NULL)
-    clock_pointer = list_begin(&lru_pages);
-  struct page *cur_page;
-  while (true) {
-    cur_page = list_entry(clock_pointer, struct page, elem);
-    if (cur_page->entry->is_loaded && t == cur_page->entry->t) {
-      if (!pagedir_is_accessed(cur_page->entry->t->pagedir,
-                               cur_page->entry->vaddr)) {
-        break;
-      }
-
-      pagedir_set_accessed(cur_page->entry->t->pagedir, cur_page->entry->vaddr,
-                           false);
-    }
-    clock_pointer = list_next(clock_pointer);
-    if (clock_pointer == list_end(&lru_pages))
-      clock_pointer = list_begin(&lru_pages);
-  }
-
-  return cur_page;
-}
+size_t find_free_swap_slots(size_t cnt);
 
-void *swap_out() {
-  struct page *freed_page = select_victim();
+/* Saves the contents of the CNT frames in VICTIMS, whose
+   mappings have already been removed, so that their pages can
+   be brought back in later: dirty mmap pages go back to their
+   files, anonymous and modified executable pages go to swap, and
+   clean pages are dropped.  The pages bound for swap get a run
+   of consecutive slots if possible and are submitted together,
+   so the I/O scheduler merges them into one sequential write,
+   and the mmap pages are written back while that write is in
+   flight. */
+void swap_out(struct page *victims[], size_t cnt) {
+  struct page *to_swap[SWAP_OUT_MAX];
+  struct page *to_file[SWAP_OUT_MAX];
+  struct block_request reqs[SWAP_OUT_MAX];
+  size_t swap_cnt = 0;
+  size_t file_cnt = 0;
+  size_t first_slot = BITMAP_ERROR;
+  size_t i;
 
-  ASSERT(freed_page);
-  struct vm_entry *entry = freed_page->entry;
+  ASSERT(cnt <= SWAP_OUT_MAX);
+  for (i = 0; i < cnt; i++) {
+    struct vm_entry *entry = victims[i]->entry;
 
-  ASSERT(entry);
-  void *kaddr = freed_page->kaddr;
-  switch (entry->type) {
-  case VM_BIN:
-    if (pagedir_is_dirty(entry->t->pagedir, entry->vaddr)) {
-      // TODO disk write
-      entry->swap_index = write_swap_page(freed_page->kaddr);
-      ASSERT(entry->swap_index != BITMAP_ERROR);
-
-      entry->type = VM_ANON;
-    }
-    entry->is_loaded = false;
-    pagedir_clear_page(entry->t->pagedir, entry->vaddr);
-    break;
-  case VM_FILE:
-    if (pagedir_is_dirty(entry->t->pagedir, entry->vaddr)) {
-      lock_acquire(&swap_lock);
-      file_write_at(entry->file, kaddr, entry->read_bytes, entry->offset);
-      lock_release(&swap_lock);
+    ASSERT(entry);
+    switch (entry->type) {
+    case VM_BIN:
+      if (pagedir_is_dirty(entry->t->pagedir, entry->vaddr))
+        to_swap[swap_cnt++] = victims[i];
+      break;
+    case VM_FILE:
+      if (pagedir_is_dirty(entry->t->pagedir, entry->vaddr))
+        to_file[file_cnt++] = victims[i];
+      break;
+    case VM_ANON:
+      to_swap[swap_cnt++] = victims[i];
+      break;
     }
-    entry->is_loaded = false;
-    pagedir_clear_page(entry->t->pagedir, entry->vaddr);
-    break;
+  }
 
-  case VM_ANON:
-    entry->swap_index = write_swap_page(freed_page->kaddr);
-    entry->is_loaded = false;
-    ASSERT(entry->swap_index != BITMAP_ERROR);
+  /* Fall back to single slots if swap is too fragmented. */
+  if (swap_cnt > 0)
+    first_slot = find_free_swap_slots(swap_cnt);
+  for (i = 0; i < swap_cnt; i++) {
+    struct vm_entry *entry = to_swap[i]->entry;
+    size_t slot =
+        first_slot != BITMAP_ERROR ? first_slot + i : find_free_swap_slots(1);
+    if (slot == BITMAP_ERROR)
+      PANIC("No free swap slots available.");
 
-    pagedir_clear_page(entry->t->pagedir, entry->vaddr);
-    break;
+    entry->swap_index = slot;
+    entry->type = VM_ANON;
+    block_request_init(&reqs[i], true, slot * SECTORS_PER_PAGE,
+                       SECTORS_PER_PAGE, to_swap[i]->kaddr, NULL, NULL);
+    block_submit(swap_block, &reqs[i]);
   }
 
-  return kaddr;
+  for (i = 0; i < file_cnt; i++) {
+    struct vm_entry *entry = to_file[i]->entry;
+    file_write_at(entry->file, to_file[i]->kaddr, entry->read_bytes,
+                  entry->offset);
+  }
+  for (i = 0; i < swap_cnt; i++)
+    block_wait(&reqs[i]);
 }
 
 void swap_init(void) {
@@ -94,36 +101,179 @@ void swap_init(void) {
   bitmap_set_all(swap_bitmap, false);
 
   lock_init(&swap_lock);
+  next_slot = 0;
 }
 
-size_t find_free_swap_slot(void) {
+/* Allocates CNT consecutive swap slots, searching from where the
+   last run ended, and returns the first one, or BITMAP_ERROR if
+   there is no such run. */
+size_t find_free_swap_slots(size_t cnt) {
   lock_acquire(&swap_lock);
-  size_t free_slot = bitmap_scan_and_flip(swap_bitmap, 0, 1, false);
+  size_t free_slot = bitmap_scan_and_flip(swap_bitmap, next_slot, cnt, false);
+  if (free_slot == BITMAP_ERROR && next_slot != 0)
+    free_slot = bitmap_scan_and_flip(swap_bitmap, 0, cnt, false);
+  if (free_slot != BITMAP_ERROR)
+    next_slot = free_slot + cnt;
   lock_release(&swap_lock);
   return free_slot;
 }
 
-size_t write_swap_page(void *kaddr) {
-  size_t free_slot = find_free_swap_slot();
-  if (free_slot == BITMAP_ERROR) {
-    PANIC("No free swap slots available.");
+/* Adjusts the current process's read-around window according
+   to how many of the pages read around at its last swap-in have
+   been used since: the window doubles if at least half were
+   used, and halves otherwise.  A page counts as used if it is
+   still mapped and has been accessed, which misses pages whose
+   accessed bit the clock has cleared since. */
+static void adapt_window(struct thread *t) {
+  size_t hits = 0;
+  size_t i;
+
+  if (t->swap_ra_cnt == 0)
+    return;
+  for (i = 0; i < t->swap_ra_cnt; i++) {
+    uint8_t *upage = (uint8_t *)t->swap_ra_start + i * PGSIZE;
+    if (pagedir_get_page(t->pagedir, upage) != NULL &&
+        pagedir_is_accessed(t->pagedir, upage))
+      hits++;
   }
 
   lock_acquire(&swap_lock);
-  for (int i = 0; i < SECTORS_PER_PAGE; i++) {
-    block_sector_t sector = free_slot * SECTORS_PER_PAGE + i;
-    block_write(swap_block, sector, kaddr + i * BLOCK_SECTOR_SIZE);
+  ra_hit_cnt += hits;
+  lock_release(&swap_lock);
+
+  if (hits * 2 >= t->swap_ra_cnt)
+    t->swap_ra_window = t->swap_ra_window * 2 < SWAP_RA_MAX
+                            ? t->swap_ra_window * 2
+                            : SWAP_RA_MAX;
+  else
+    t->swap_ra_window = t->swap_ra_window / 2 > SWAP_RA_MIN
+                            ? t->swap_ra_window / 2
+                            : SWAP_RA_MIN;
+  t->swap_ra_cnt = 0;
+}
+
+/* Reads ENTRY's page back from swap into KPAGE, a pinned frame.
+   Also reads around it: up to the process's read-around window
+   of the virtual pages that follow ENTRY's, as long as they are
+   in swap too, are read into free frames and mapped, in the bet
+   that the process is scanning through memory.
+
+   Swap I/O is handed to the swap device's I/O thread rather
+   than done under swap_lock, which only guards the bitmap.  All
+   of the reads are submitted before any is waited for, so the
+   I/O scheduler merges those for consecutive slots, and file
+   system I/O on the other IDE channel proceeds at the same
+   time. */
+void swap_in(struct vm_entry *entry, struct page *kpage) {
+  struct thread *t = thread_current();
+  struct vm_entry *entries[SWAP_RA_MAX + 1];
+  struct page *pages[SWAP_RA_MAX + 1];
+  struct block_request reqs[SWAP_RA_MAX + 1];
+  size_t cnt = 0;
+  size_t installed_cnt = 0;
+  size_t i;
+
+  adapt_window(t);
+
+  entries[cnt] = entry;
+  pages[cnt++] = kpage;
+  for (i = 1; i <= t->swap_ra_window; i++) {
+    uint8_t *upage = (uint8_t *)entry->vaddr + i * PGSIZE;
+    struct vm_entry *e;
+    struct page *p;
+    void *kaddr;
+
+    if (!is_user_vaddr(upage))
+      break;
+    e = find_vm_entry(&t->vm_table, upage);
+    if (e == NULL || e->type != VM_ANON || e->cow)
+      break;
+    kaddr = frame_pin_entry(e);
+    if (kaddr != NULL) {
+      unpin_page(kaddr);
+      break;
+    }
+    p = alloc_free_page(PAL_USER);
+    if (p == NULL)
+      break;
+    entries[cnt] = e;
+    pages[cnt++] = p;
+  }
+
+  for (i = 0; i < cnt; i++) {
+    block_request_init(&reqs[i], false,
+                       entries[i]->swap_index * SECTORS_PER_PAGE,
+                       SECTORS_PER_PAGE, pages[i]->kaddr, NULL, NULL);
+    block_submit(swap_block, &reqs[i]);
+  }
+  for (i = 0; i < cnt; i++)
+    block_wait(&reqs[i]);
+
+  /* The slots are only released once the reads are done, so that
+     a concurrent page-out cannot overwrite them first. */
+  swap_free(entry->swap_index);
+
+  /* Map the pages read around.  They start out unaccessed, so
+     the clock reclaims them first if they go unused.  A page that
+     cannot be mapped keeps its slot, which still holds the only
+     copy of it. */
+  for (i = 1; i < cnt; i++) {
+    if (install_page(entries[i]->vaddr, pages[i]->kaddr,
+                     entries[i]->writable)) {
+      swap_free(entries[i]->swap_index);
+      entries[i]->is_loaded = true;
+      pages[i]->entry = entries[i];
+      unpin_page(pages[i]->kaddr);
+      installed_cnt++;
+    } else
+      free_page(pages[i]->kaddr);
   }
+  lock_acquire(&swap_lock);
+  ra_page_cnt += installed_cnt;
   lock_release(&swap_lock);
-  return free_slot;
+  t->swap_ra_start = (uint8_t *)entry->vaddr + PGSIZE;
+  t->swap_ra_cnt = cnt - 1;
 }
 
-void read_swap_page(size_t disk_index, void *kaddr) {
+/* Releases swap slot DISK_INDEX without reading it, when the
+   page stored there is discarded. */
+void swap_free(size_t disk_index) {
   lock_acquire(&swap_lock);
-  for (int i = 0; i < SECTORS_PER_PAGE; i++) {
-    block_sector_t sector = disk_index * SECTORS_PER_PAGE + i;
-    block_read(swap_block, sector, kaddr + i * BLOCK_SECTOR_SIZE);
-  }
-  bitmap_flip(swap_bitmap, disk_index);
+  ASSERT(bitmap_test(swap_bitmap, disk_index));
+  bitmap_reset(swap_bitmap, disk_index);
   lock_release(&swap_lock);
-}
\ No newline at end of file
+}
+
+/* Starts writing the page at KADDR to a free swap slot through
+   REQ and returns the slot, for a page shared by several
+   processes, which swap_out() cannot handle since it has no
+   single owner.  The caller must block_wait() on REQ before
+   reusing the page. */
+size_t swap_write_page(const void *kaddr, struct block_request *req) {
+  size_t slot = find_free_swap_slots(1);
+
+  if (slot == BITMAP_ERROR)
+    PANIC("No free swap slots available.");
+  block_request_init(req, true, slot * SECTORS_PER_PAGE, SECTORS_PER_PAGE,
+                     (void *)kaddr, NULL, NULL);
+  block_submit(swap_block, req);
+  return slot;
+}
+
+/* Reads the page in swap slot DISK_INDEX into KADDR and releases
+   the slot. */
+void swap_read_page(size_t disk_index, void *kaddr) {
+  struct block_request req;
+
+  block_request_init(&req, false, disk_index * SECTORS_PER_PAGE,
+                     SECTORS_PER_PAGE, kaddr, NULL, NULL);
+  block_submit(swap_block, &req);
+  block_wait(&req);
+  swap_free(disk_index);
+}
+
+/* Prints swap read-around statistics. */
+void swap_print_stats(void) {
+  printf("Swap: %llu pages read around, %llu used\n", ra_page_cnt,
+         ra_hit_cnt);
+}
@@ -1,9 +1,22 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
+#include "devices/block.h"
 #include "page.h"
 
-void *swap_out(void);
+/* Maximum number of pages written out by one swap_out(). */
+#define SWAP_OUT_MAX 8
+
+/* Swap read-around window bounds, in pages. */
+#define SWAP_RA_MIN 1
+#define SWAP_RA_INIT 4
+#define SWAP_RA_MAX 8
+
+void swap_out(struct page *victims[], size_t cnt);
 void swap_init(void);
-void read_swap_page(size_t disk_index, void *kaddr);
+void swap_in(struct vm_entry *entry, struct page *kpage);
+void swap_free(size_t disk_index);
+size_t swap_write_page(const void *kaddr, struct block_request *req);
+void swap_read_page(size_t disk_index, void *kaddr);
+void swap_print_stats(void);
 
 #endif
\ No newline at end of file